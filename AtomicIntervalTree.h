@@ -0,0 +1,159 @@
+#ifndef __ATOMIC_INTERVAL_TREE_H
+#define __ATOMIC_INTERVAL_TREE_H
+
+#include <atomic>
+#include <cstddef>
+#include <cstdint>
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <utility>
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+namespace interval_tree {
+#endif
+
+// Holds the current version of a tree for many concurrent readers and
+// occasional writers, in the style of read-copy-update. Readers never take
+// a lock: read() registers the reader in the current epoch and returns a
+// handle to the tree. A writer builds the next tree wherever it likes and
+// publish()es it; publishing swaps the pointer, starts a new epoch and
+// waits until every reader of the previous epoch has released its handle
+// before destroying the old tree. Tree is any tree type, e.g. IntervalTree
+// or MappedIntervalTree.
+//
+// Each epoch parity has its own reader counters, striped over cache lines
+// so that readers on different threads rarely share one.
+template <class Tree>
+class AtomicIntervalTree {
+public:
+    typedef Tree tree_type;
+
+    // Keeps the tree it refers to alive until it is destroyed. Handles
+    // should be short-lived, as a writer publishing a new tree waits for
+    // them.
+    class ReadHandle {
+    public:
+        ReadHandle(ReadHandle&& other)
+            : tree(other.tree)
+            , counter(other.counter)
+        {
+            other.counter = nullptr;
+        }
+
+        ReadHandle(const ReadHandle&) = delete;
+        ReadHandle& operator=(const ReadHandle&) = delete;
+        ReadHandle& operator=(ReadHandle&&) = delete;
+
+        ~ReadHandle() {
+            if (counter) {
+                counter->fetch_sub(1);
+            }
+        }
+
+        const Tree& operator*() const { return *tree; }
+        const Tree* operator->() const { return tree; }
+        const Tree* get() const { return tree; }
+
+    private:
+        friend class AtomicIntervalTree;
+
+        ReadHandle(const Tree* tree, std::atomic<std::ptrdiff_t>* counter)
+            : tree(tree)
+            , counter(counter)
+        {}
+
+        const Tree* tree;
+        std::atomic<std::ptrdiff_t>* counter;
+    };
+
+    AtomicIntervalTree()
+        : current(new Tree())
+        , epoch(0)
+    {
+        clearCounters();
+    }
+
+    explicit AtomicIntervalTree(Tree&& tree)
+        : current(new Tree(std::move(tree)))
+        , epoch(0)
+    {
+        clearCounters();
+    }
+
+    AtomicIntervalTree(const AtomicIntervalTree&) = delete;
+    AtomicIntervalTree& operator=(const AtomicIntervalTree&) = delete;
+
+    // No handles may outlive the wrapper.
+    ~AtomicIntervalTree() {
+        delete current.load();
+    }
+
+    ReadHandle read() const {
+        std::atomic<std::ptrdiff_t>* counter;
+        for (;;) {
+            const std::uint64_t e = epoch.load();
+            counter = &readers[e & 1][stripe()].count;
+            counter->fetch_add(1);
+            // a writer that changed the epoch meanwhile may already have
+            // checked this counter
+            if (epoch.load() == e) {
+                break;
+            }
+            counter->fetch_sub(1);
+        }
+        return ReadHandle(current.load(), counter);
+    }
+
+    // Replace the tree. Returns once no reader can still see the previous
+    // tree, which has then been destroyed.
+    void publish(Tree&& tree) {
+        publish(std::unique_ptr<Tree>(new Tree(std::move(tree))));
+    }
+
+    void publish(std::unique_ptr<Tree> tree) {
+        std::lock_guard<std::mutex> lock(writer);
+        std::unique_ptr<Tree> old(current.exchange(tree.release()));
+        // readers registered under the old epoch may hold the old tree;
+        // later readers see the new one
+        const std::uint64_t e = epoch.fetch_add(1);
+        for (Counter& c : readers[e & 1]) {
+            while (c.count.load() != 0) {
+                std::this_thread::yield();
+            }
+        }
+    }
+
+private:
+    static const std::size_t stripes = 16;
+
+    struct alignas(64) Counter {
+        std::atomic<std::ptrdiff_t> count;
+    };
+
+    static std::size_t stripe() {
+        static thread_local const std::size_t s =
+            std::hash<std::thread::id>()(std::this_thread::get_id()) % stripes;
+        return s;
+    }
+
+    void clearCounters() {
+        for (auto& parity : readers) {
+            for (Counter& c : parity) {
+                c.count.store(0);
+            }
+        }
+    }
+
+    std::atomic<Tree*> current;
+    std::atomic<std::uint64_t> epoch;
+    mutable Counter readers[2][stripes];
+    std::mutex writer;
+};
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+}
+#endif
+
+#endif
@@ -0,0 +1,207 @@
+#ifndef __COMPRESSED_INTERVAL_TREE_H
+#define __COMPRESSED_INTERVAL_TREE_H
+
+#include <cstdint>
+#include <cstring>
+#include <type_traits>
+#include <vector>
+
+#include "IntervalTree.h"
+#include "IntervalTreeIndex.h"
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+namespace interval_tree {
+#endif
+
+// A read-only copy of an IntervalTree with integral coordinates, with the
+// coordinates of each node bucket compressed. Buckets are sorted by start,
+// so each start is stored as an offset from the bucket's first start and
+// each stop as a length, both in the fewest bytes (1, 2, 4 or 8) that hold
+// the bucket's largest offset and length. Values are kept in a separate
+// array and never copied by queries: intervals are decoded while a bucket
+// is scanned into an Interval<Scalar, const Value*> whose value points to
+// the stored value. The decoded intervals passed to callbacks are
+// temporaries, only valid during the call; the values they point to live
+// as long as the tree.
+template <class Scalar, class Value>
+class CompressedIntervalTree
+    : public IndexQueries<CompressedIntervalTree<Scalar, Value>, Scalar, const Value*> {
+public:
+    typedef Interval<Scalar, const Value*> interval;
+    typedef std::vector<interval> interval_vector;
+    typedef IntervalTree<Scalar, Value> tree_type;
+    typedef typename tree_type::interval tree_interval;
+
+    static_assert(std::is_integral<Scalar>::value,
+                  "compressed coordinates require an integral Scalar");
+
+    CompressedIntervalTree() {}
+
+    explicit CompressedIntervalTree(const tree_type& tree) {
+        if (!tree.empty()) {
+            add(tree);
+        }
+        nodes.shrink_to_fit();
+        coordinates.shrink_to_fit();
+        values.shrink_to_fit();
+    }
+
+    // Call f on all intervals near the range [start, stop]:
+    template <class UnaryFunction>
+    void visit_near(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        if (!nodes.empty()) {
+            visit_near(0, start, stop, f);
+        }
+    }
+
+    template <class UnaryFunction>
+    void visit_all(UnaryFunction f) const {
+        if (!nodes.empty()) {
+            visit_all(0, f);
+        }
+    }
+
+    bool empty() const { return values.empty(); }
+    std::size_t size() const { return values.size(); }
+
+    // Bytes held by the nodes, coordinates and values.
+    std::size_t bytes() const {
+        return sizeof(*this) + nodes.capacity() * sizeof(Node)
+            + coordinates.capacity() + values.capacity() * sizeof(Value);
+    }
+
+private:
+    typedef typename std::make_unsigned<Scalar>::type Unsigned;
+
+    static const std::size_t none = ~std::size_t(0);
+
+    struct Node {
+        Scalar center;
+        Scalar base;                // start of the bucket's first interval
+        std::size_t begin;          // bucket range in values
+        std::size_t end;
+        std::size_t offsets;        // bucket's start offsets in coordinates
+        std::size_t left;
+        std::size_t right;
+        unsigned char offsetBytes;
+        unsigned char lengthBytes;
+    };
+
+    // Append t and its subtrees in preorder and return t's node index.
+    std::size_t add(const tree_type& t) {
+        const std::size_t n = nodes.size();
+        nodes.push_back(Node());
+        Node node = Node();
+        node.center = t.center;
+        node.begin = values.size();
+        node.end = node.begin + t.intervals.size();
+        node.offsets = coordinates.size();
+        Unsigned maxOffset = 0;
+        Unsigned maxLength = 0;
+        if (!t.intervals.empty()) {
+            node.base = t.intervals.front().start;
+            for (const tree_interval& i : t.intervals) {
+                maxOffset = std::max(maxOffset, Unsigned(Unsigned(i.start) - Unsigned(node.base)));
+                maxLength = std::max(maxLength, Unsigned(Unsigned(i.stop) - Unsigned(i.start)));
+            }
+        }
+        node.offsetBytes = width(maxOffset);
+        node.lengthBytes = width(maxLength);
+        for (const tree_interval& i : t.intervals) {
+            store(Unsigned(i.start) - Unsigned(node.base), node.offsetBytes);
+        }
+        for (const tree_interval& i : t.intervals) {
+            store(Unsigned(i.stop) - Unsigned(i.start), node.lengthBytes);
+            values.push_back(i.value);
+        }
+        node.left = t.left ? add(*t.left) : none;
+        node.right = t.right ? add(*t.right) : none;
+        nodes[n] = node;
+        return n;
+    }
+
+    static unsigned char width(Unsigned max) {
+        unsigned char bytes = 1;
+        while (bytes < sizeof(Unsigned) && (max >> (8 * bytes)) != 0) {
+            bytes *= 2;
+        }
+        return bytes;
+    }
+
+    void store(Unsigned x, unsigned char bytes) {
+        switch (bytes) {
+        case 1: append(std::uint8_t(x)); break;
+        case 2: append(std::uint16_t(x)); break;
+        case 4: append(std::uint32_t(x)); break;
+        default: append(std::uint64_t(x)); break;
+        }
+    }
+
+    template <class T>
+    void append(T x) {
+        const std::size_t at = coordinates.size();
+        coordinates.resize(at + sizeof(T));
+        std::memcpy(&coordinates[at], &x, sizeof(T));
+    }
+
+    static Unsigned load(const unsigned char* p, unsigned char bytes) {
+        switch (bytes) {
+        case 1: return *p;
+        case 2: { std::uint16_t x; std::memcpy(&x, p, sizeof(x)); return Unsigned(x); }
+        case 4: { std::uint32_t x; std::memcpy(&x, p, sizeof(x)); return Unsigned(x); }
+        default: { std::uint64_t x; std::memcpy(&x, p, sizeof(x)); return Unsigned(x); }
+        }
+    }
+
+    template <class UnaryFunction>
+    void scan(const Node& node, UnaryFunction& f) const {
+        const std::size_t count = node.end - node.begin;
+        const unsigned char* offsets = coordinates.data() + node.offsets;
+        const unsigned char* lengths = offsets + count * node.offsetBytes;
+        for (std::size_t k = 0; k != count; ++k) {
+            const Scalar start = Scalar(Unsigned(node.base)
+                                        + load(offsets + k * node.offsetBytes, node.offsetBytes));
+            const Scalar stop = Scalar(Unsigned(start)
+                                       + load(lengths + k * node.lengthBytes, node.lengthBytes));
+            const interval decoded(start, stop, &values[node.begin + k]);
+            f(decoded);
+        }
+    }
+
+    template <class UnaryFunction>
+    void visit_near(std::size_t n, const Scalar& start, const Scalar& stop,
+                    UnaryFunction& f) const {
+        const Node& node = nodes[n];
+        if (node.begin != node.end && ! (stop < node.base)) {
+            scan(node, f);
+        }
+        if (node.left != none && start <= node.center) {
+            visit_near(node.left, start, stop, f);
+        }
+        if (node.right != none && stop >= node.center) {
+            visit_near(node.right, start, stop, f);
+        }
+    }
+
+    template <class UnaryFunction>
+    void visit_all(std::size_t n, UnaryFunction& f) const {
+        const Node& node = nodes[n];
+        if (node.left != none) {
+            visit_all(node.left, f);
+        }
+        scan(node, f);
+        if (node.right != none) {
+            visit_all(node.right, f);
+        }
+    }
+
+    std::vector<Node> nodes;
+    std::vector<unsigned char> coordinates;
+    std::vector<Value> values;
+};
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+}
+#endif
+
+#endif
@@ -0,0 +1,100 @@
+#ifndef __INDEXED_INTERVAL_TREE_H
+#define __INDEXED_INTERVAL_TREE_H
+
+#include <cstdint>
+#include <limits>
+#include <stdexcept>
+#include <utility>
+#include <vector>
+
+#include "IntervalTree.h"
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+namespace interval_tree {
+#endif
+
+// An IntervalTree for large values. The tree itself only holds the
+// endpoints and an Index into a value array owned alongside it, so
+// building moves each value once instead of copying it down every level,
+// and queries scan narrow buckets. Callbacks receive the narrow interval;
+// value(i) returns its value.
+template <class Scalar, class Value, class Index = std::uint32_t>
+class IndexedIntervalTree {
+public:
+    typedef Interval<Scalar, Value> value_interval;
+    typedef std::vector<value_interval> value_interval_vector;
+    typedef IntervalTree<Scalar, Index> tree_type;
+    typedef typename tree_type::interval interval;
+    typedef typename tree_type::interval_vector interval_vector;
+
+    IndexedIntervalTree() {}
+
+    IndexedIntervalTree(value_interval_vector&& ivals,
+                        std::size_t depth = 16,
+                        std::size_t minbucket = 64,
+                        std::size_t maxbucket = 512)
+    {
+        if (ivals.size() > std::size_t(std::numeric_limits<Index>::max())) {
+            throw std::runtime_error("too many intervals for the index type");
+        }
+        interval_vector narrow;
+        narrow.reserve(ivals.size());
+        values.reserve(ivals.size());
+        for (value_interval& i : ivals) {
+            narrow.push_back(interval(i.start, i.stop, Index(values.size())));
+            values.push_back(std::move(i.value));
+        }
+        ivals.clear();
+        tree = tree_type(std::move(narrow), depth, minbucket, maxbucket);
+    }
+
+    const Value& value(const interval& i) const { return values[i.value]; }
+    Value& value(const interval& i) { return values[i.value]; }
+
+    // Call f on all intervals overlapping [start, stop]
+    template <class UnaryFunction>
+    void visit_overlapping(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        tree.visit_overlapping(start, stop, f);
+    }
+
+    // Call f on all intervals contained within [start, stop]
+    template <class UnaryFunction>
+    void visit_contained(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        tree.visit_contained(start, stop, f);
+    }
+
+    template <class Queries, class BinaryFunction>
+    void visit_overlapping_batch(const Queries& queries, BinaryFunction f,
+                                 std::size_t group = 16) const {
+        tree.visit_overlapping_batch(queries, f, group);
+    }
+
+    template <class UnaryFunction>
+    void visit_all(UnaryFunction f) const {
+        tree.visit_all(f);
+    }
+
+    interval_vector findOverlapping(const Scalar& start, const Scalar& stop) const {
+        return tree.findOverlapping(start, stop);
+    }
+
+    interval_vector findContained(const Scalar& start, const Scalar& stop) const {
+        return tree.findContained(start, stop);
+    }
+
+    bool empty() const { return values.empty(); }
+    std::size_t size() const { return values.size(); }
+
+    // The tree of endpoints and indexes, for the rest of the query API.
+    const tree_type& indexTree() const { return tree; }
+
+private:
+    tree_type tree;
+    std::vector<Value> values;
+};
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+}
+#endif
+
+#endif
@@ -0,0 +1,308 @@
+#ifndef __INTERVAL_FILE_LOADER_H
+#define __INTERVAL_FILE_LOADER_H
+
+#include <cstdlib>
+#include <cstring>
+#include <exception>
+#include <limits>
+#include <map>
+#include <stdexcept>
+#include <string>
+#include <thread>
+#include <type_traits>
+#include <vector>
+
+#include "IntervalTree.h"
+#include "MappedFile.h"
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+namespace interval_tree {
+#endif
+
+// Tab-delimited interval formats. All are converted to the same 1-based
+// closed coordinates, so intervals from different formats can share a
+// tree:
+//  - BED: 0-based half-open [start, end) becomes [start + 1, end]
+//  - GFF/GTF: 1-based closed [start, end] is kept as is
+//  - VCF: POS with a REF allele of n bases becomes [POS, POS + n - 1]
+enum IntervalFormat {
+    BED,
+    GFF,
+    VCF
+};
+
+// A view of a single column of the line being parsed.
+struct IntervalField {
+    const char* data;
+    std::size_t size;
+
+    std::string str() const { return std::string(data, size); }
+};
+
+// One parsed line, handed to the value function. Fields are views into the
+// file and are only valid during the call.
+template <class Scalar>
+struct IntervalRecord {
+    IntervalField contig;
+    Scalar start;
+    Scalar stop;
+    const char* line;
+    const char* lineEnd;
+
+    // The n-th (0-based) tab-separated column, or an empty field.
+    IntervalField field(std::size_t n) const {
+        const char* p = line;
+        for (; n != 0 && p != lineEnd; ++p) {
+            if (*p == '\t') {
+                --n;
+            }
+        }
+        const char* e = p;
+        while (e != lineEnd && *e != '\t') {
+            ++e;
+        }
+        IntervalField f = { p, static_cast<std::size_t>(e - p) };
+        return f;
+    }
+};
+
+template <class Scalar, class Value>
+struct IntervalFileLoader {
+    typedef Interval<Scalar, Value> interval;
+    typedef std::vector<interval> interval_vector;
+    typedef std::map<std::string, interval_vector> contig_map;
+
+    // Parse [begin, end), which must start at a line boundary, appending
+    // to the per-contig vectors in file order.
+    template <class ValueFunction>
+    static void parse(const char* begin, const char* end, IntervalFormat format,
+                      ValueFunction& makeValue, contig_map& result) {
+        interval_vector* current = nullptr;
+        std::string currentContig;
+        const char* p = begin;
+        while (p != end) {
+            const char* lineEnd = static_cast<const char*>(std::memchr(p, '\n', end - p));
+            if (!lineEnd) {
+                lineEnd = end;
+            }
+            const char* next = lineEnd == end ? end : lineEnd + 1;
+            if (lineEnd != p && lineEnd[-1] == '\r') {
+                --lineEnd;
+            }
+            if (lineEnd == p || isHeader(p, lineEnd)) {
+                p = next;
+                continue;
+            }
+
+            IntervalRecord<Scalar> record;
+            record.line = p;
+            record.lineEnd = lineEnd;
+            record.contig = record.field(0);
+            coordinates(record, format);
+
+            if (!current || currentContig.size() != record.contig.size
+                || std::memcmp(currentContig.data(), record.contig.data,
+                               record.contig.size) != 0) {
+                currentContig.assign(record.contig.data, record.contig.size);
+                current = &result[currentContig];
+            }
+            current->push_back(interval(record.start, record.stop, makeValue(record)));
+            p = next;
+        }
+    }
+
+    // Split the mapped file into line-aligned chunks, parse them in
+    // parallel, and concatenate the results in file order so that sorted
+    // input stays sorted.
+    template <class ValueFunction>
+    static contig_map load(const std::string& path, IntervalFormat format,
+                           ValueFunction makeValue, unsigned threads) {
+        MappedFile file(path);
+        if (file.size() == 0) {
+            // nothing is mapped, so there is nothing to split
+            return contig_map();
+        }
+        file.adviseSequential();
+        const char* data = file.data();
+        const char* end = data + file.size();
+        if (threads == 0) {
+            threads = 1;
+        }
+
+        std::vector<const char*> bounds(1, data);
+        for (unsigned t = 1; t < threads; ++t) {
+            const char* cut = data + file.size() / threads * t;
+            if (cut < bounds.back()) {
+                cut = bounds.back();
+            }
+            const char* nl = static_cast<const char*>(std::memchr(cut, '\n', end - cut));
+            bounds.push_back(nl ? nl + 1 : end);
+        }
+        bounds.push_back(end);
+
+        const std::size_t chunks = bounds.size() - 1;
+        std::vector<contig_map> parts(chunks);
+        std::vector<std::exception_ptr> errors(chunks);
+        std::vector<std::thread> workers;
+        for (std::size_t c = 1; c < chunks; ++c) {
+            workers.push_back(std::thread([&, c]() {
+                try {
+                    parse(bounds[c], bounds[c + 1], format, makeValue, parts[c]);
+                } catch (...) {
+                    errors[c] = std::current_exception();
+                }
+            }));
+        }
+        try {
+            parse(bounds[0], bounds[1], format, makeValue, parts[0]);
+        } catch (...) {
+            errors[0] = std::current_exception();
+        }
+        for (auto& w : workers) {
+            w.join();
+        }
+        for (auto& e : errors) {
+            if (e) {
+                std::rethrow_exception(e);
+            }
+        }
+
+        contig_map result = std::move(parts[0]);
+        for (std::size_t c = 1; c < chunks; ++c) {
+            for (auto& contig : parts[c]) {
+                interval_vector& into = result[contig.first];
+                if (into.empty()) {
+                    into = std::move(contig.second);
+                } else {
+                    into.insert(into.end(),
+                                std::make_move_iterator(contig.second.begin()),
+                                std::make_move_iterator(contig.second.end()));
+                }
+            }
+        }
+        return result;
+    }
+
+private:
+    static bool isHeader(const char* p, const char* lineEnd) {
+        const std::size_t n = lineEnd - p;
+        return *p == '#'
+            || (n >= 5 && std::memcmp(p, "track", 5) == 0)
+            || (n >= 7 && std::memcmp(p, "browser", 7) == 0);
+    }
+
+    static void coordinates(IntervalRecord<Scalar>& record, IntervalFormat format) {
+        switch (format) {
+        case BED: {
+            const Scalar start = number(record.field(1), record);
+            const Scalar end = number(record.field(2), record);
+            if (!(start < std::numeric_limits<Scalar>::max())) {
+                malformed(record);
+            }
+            record.start = start + 1;
+            // an empty BED feature covers the base after it rather than flipping
+            record.stop = end > start ? end : record.start;
+            break;
+        }
+        case GFF:
+            record.start = number(record.field(3), record);
+            record.stop = number(record.field(4), record);
+            break;
+        case VCF: {
+            typedef IntervalDifference<Scalar> Difference;
+            record.start = number(record.field(1), record);
+            const std::size_t ref = record.field(3).size;
+            // the end of the REF allele must still fit in Scalar
+            if (ref > 1 && Difference::between(record.start, std::numeric_limits<Scalar>::max())
+                           < typename Difference::type(ref - 1)) {
+                malformed(record);
+            }
+            record.stop = ref > 1 ? record.start + Scalar(ref - 1) : record.start;
+            break;
+        }
+        }
+    }
+
+    static Scalar number(const IntervalField& f, const IntervalRecord<Scalar>& record) {
+        return parseNumber(f, record, std::is_integral<Scalar>());
+    }
+
+    static Scalar parseNumber(const IntervalField& f, const IntervalRecord<Scalar>& record,
+                              std::true_type) {
+        typedef typename std::make_unsigned<Scalar>::type Unsigned;
+        const char* p = f.data;
+        const char* e = f.data + f.size;
+        bool negative = false;
+        if (p != e && (*p == '-' || *p == '+')) {
+            negative = *p == '-';
+            ++p;
+        }
+        if (p == e || (negative && !std::is_signed<Scalar>::value)) {
+            malformed(record);
+        }
+        // the magnitude of the most negative value is one more than the maximum
+        const Unsigned limit = Unsigned(std::numeric_limits<Scalar>::max())
+                               + (negative ? 1 : 0);
+        Unsigned n = 0;
+        for (; p != e; ++p) {
+            const unsigned d = static_cast<unsigned>(*p - '0');
+            if (d > 9 || n > (limit - d) / 10) {
+                malformed(record);
+            }
+            n = n * 10 + Unsigned(d);
+        }
+        if (negative && n != 0) {
+            return Scalar(-Scalar(n - 1) - 1);
+        }
+        return Scalar(n);
+    }
+
+    static Scalar parseNumber(const IntervalField& f, const IntervalRecord<Scalar>& record,
+                              std::false_type) {
+        const std::string s = f.str();
+        char* e = nullptr;
+        const double n = std::strtod(s.c_str(), &e);
+        if (s.empty() || *e != '\0') {
+            malformed(record);
+        }
+        return static_cast<Scalar>(n);
+    }
+
+    static void malformed(const IntervalRecord<Scalar>& record) {
+        throw std::runtime_error("malformed interval line: "
+                                 + std::string(record.line, record.lineEnd));
+    }
+};
+
+// Load every interval of a BED, GFF or VCF file, grouped by contig (the
+// first column). makeValue is called with each IntervalRecord to build the
+// interval's value; with threads > 1 it is called concurrently from several
+// threads. Each contig's intervals are in file order, so a sorted file
+// builds its trees without sorting.
+template <class Scalar, class Value, class ValueFunction>
+std::map<std::string, std::vector<Interval<Scalar, Value> > >
+loadIntervals(const std::string& path, IntervalFormat format,
+              ValueFunction makeValue, unsigned threads = 1) {
+    return IntervalFileLoader<Scalar, Value>::load(path, format, makeValue, threads);
+}
+
+// Load a file holding the intervals of a single contig straight into a tree.
+template <class Scalar, class Value, class ValueFunction>
+IntervalTree<Scalar, Value>
+loadIntervalTree(const std::string& path, IntervalFormat format,
+                 ValueFunction makeValue, unsigned threads = 1) {
+    auto contigs = loadIntervals<Scalar, Value>(path, format, makeValue, threads);
+    if (contigs.size() > 1) {
+        throw std::runtime_error(path + " holds intervals on more than one contig");
+    }
+    if (contigs.empty()) {
+        return IntervalTree<Scalar, Value>();
+    }
+    return IntervalTree<Scalar, Value>(std::move(contigs.begin()->second));
+}
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+}
+#endif
+
+#endif
@@ -0,0 +1,181 @@
+#ifndef __INTERVAL_FOREST_H
+#define __INTERVAL_FOREST_H
+
+#include <algorithm>
+#include <atomic>
+#include <exception>
+#include <map>
+#include <thread>
+#include <utility>
+#include <vector>
+
+#include "IntervalTree.h"
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+namespace interval_tree {
+#endif
+
+// A set of interval trees keyed by contig (a chromosome name, an integer
+// id, ...). Tree is IntervalTree or any type with the same query API, such
+// as MappedIntervalTree, so contigs can also be mapped one file each.
+template <class Key, class Tree>
+class IntervalForest {
+public:
+    typedef Key key_type;
+    typedef Tree tree_type;
+    typedef typename Tree::interval interval;
+    typedef typename Tree::interval_vector interval_vector;
+    typedef decltype(interval::start) scalar_type;
+    typedef std::map<Key, Tree> tree_map;
+    typedef typename tree_map::const_iterator const_iterator;
+
+    struct Query {
+        Key key;
+        scalar_type start;
+        scalar_type stop;
+    };
+
+    IntervalForest() {}
+
+    // Build one tree per key, spreading the builds over threads. The
+    // remaining arguments are passed to each tree's constructor.
+    IntervalForest(std::map<Key, interval_vector>&& contigs,
+                   unsigned threads = 1,
+                   std::size_t depth = 16,
+                   std::size_t minbucket = 64,
+                   std::size_t maxbucket = 512)
+    {
+        std::vector<std::pair<Tree*, interval_vector*> > work;
+        for (auto& contig : contigs) {
+            work.push_back(std::make_pair(&trees[contig.first], &contig.second));
+        }
+        // build the largest trees first so no thread is left with a big one at the end
+        std::sort(work.begin(), work.end(),
+                  [](const std::pair<Tree*, interval_vector*>& a,
+                     const std::pair<Tree*, interval_vector*>& b) {
+                      return a.second->size() > b.second->size();
+                  });
+
+        std::atomic<std::size_t> next(0);
+        std::exception_ptr error;
+        std::atomic<bool> failed(false);
+        auto build = [&]() {
+            for (std::size_t i = next++; i < work.size(); i = next++) {
+                try {
+                    *work[i].first = Tree(std::move(*work[i].second),
+                                          depth, minbucket, maxbucket);
+                } catch (...) {
+                    if (!failed.exchange(true)) {
+                        error = std::current_exception();
+                    }
+                }
+            }
+        };
+        std::vector<std::thread> workers;
+        for (unsigned t = 1; t < threads && t < work.size(); ++t) {
+            workers.push_back(std::thread(build));
+        }
+        build();
+        for (auto& w : workers) {
+            w.join();
+        }
+        contigs.clear();
+        if (error) {
+            std::rethrow_exception(error);
+        }
+    }
+
+    // Add or replace the tree for key.
+    void insert(const Key& key, Tree&& tree) {
+        trees[key] = std::move(tree);
+    }
+
+    bool erase(const Key& key) {
+        return trees.erase(key) != 0;
+    }
+
+    // The tree for key, or nullptr when there is none.
+    const Tree* find(const Key& key) const {
+        const_iterator i = trees.find(key);
+        return i == trees.end() ? nullptr : &i->second;
+    }
+
+    const_iterator begin() const { return trees.begin(); }
+    const_iterator end() const { return trees.end(); }
+    std::size_t size() const { return trees.size(); }
+
+    bool empty() const {
+        for (const auto& t : trees) {
+            if (!t.second.empty()) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+    // Call f on all intervals of key's tree overlapping [start, stop]
+    template <class UnaryFunction>
+    void visit_overlapping(const Key& key, const scalar_type& start, const scalar_type& stop,
+                           UnaryFunction f) const {
+        if (const Tree* t = find(key)) {
+            t->visit_overlapping(start, stop, f);
+        }
+    }
+
+    // Call f on all intervals of key's tree contained within [start, stop]
+    template <class UnaryFunction>
+    void visit_contained(const Key& key, const scalar_type& start, const scalar_type& stop,
+                         UnaryFunction f) const {
+        if (const Tree* t = find(key)) {
+            t->visit_contained(start, stop, f);
+        }
+    }
+
+    interval_vector findOverlapping(const Key& key, const scalar_type& start,
+                                    const scalar_type& stop) const {
+        const Tree* t = find(key);
+        return t ? t->findOverlapping(start, stop) : interval_vector();
+    }
+
+    interval_vector findContained(const Key& key, const scalar_type& start,
+                                  const scalar_type& stop) const {
+        const Tree* t = find(key);
+        return t ? t->findContained(start, stop) : interval_vector();
+    }
+
+    // Call f(q, interval) for every interval overlapping queries[q]. Queries
+    // are grouped by key so that each tree is looked up once and queried
+    // back to back.
+    template <class BinaryFunction>
+    void visit_overlapping(const std::vector<Query>& queries, BinaryFunction f) const {
+        std::vector<std::size_t> order(queries.size());
+        for (std::size_t q = 0; q != order.size(); ++q) {
+            order[q] = q;
+        }
+        std::stable_sort(order.begin(), order.end(),
+                         [&](std::size_t a, std::size_t b) {
+                             return queries[a].key < queries[b].key;
+                         });
+        const Tree* t = nullptr;
+        for (std::size_t i = 0; i != order.size(); ++i) {
+            const Query& query = queries[order[i]];
+            if (i == 0 || queries[order[i - 1]].key < query.key) {
+                t = find(query.key);
+            }
+            if (t) {
+                const std::size_t q = order[i];
+                t->visit_overlapping(query.start, query.stop,
+                                     [&](const interval& interval) { f(q, interval); });
+            }
+        }
+    }
+
+private:
+    tree_map trees;
+};
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+}
+#endif
+
+#endif
@@ -6,7 +6,19 @@
 #include <iostream>
 #include <memory>
 #include <cassert>
+#include <functional>
 #include <limits>
+#include <iterator>
+#include <queue>
+#include <type_traits>
+
+#if defined(__cpp_impl_coroutine) && defined(__has_include)
+#if __has_include(<coroutine>)
+#include <coroutine>
+#include <exception>
+#define INTERVAL_TREE_HAS_COROUTINES 1
+#endif
+#endif
 
 #ifdef USE_INTERVAL_TREE_NAMESPACE
 namespace interval_tree {
@@ -22,6 +34,19 @@ public:
     , stop(std::max(s, e))
     , value(v) 
     {}
+    Interval(const Scalar& s, const Scalar& e, Value&& v)
+    : start(std::min(s, e))
+    , stop(std::max(s, e))
+    , value(std::move(v))
+    {}
+    // Construct the value in place from two or more arguments, e.g.
+    // intervals.emplace_back(start, stop, arg1, arg2)
+    template <class A, class B, class... Args>
+    Interval(const Scalar& s, const Scalar& e, A&& a, B&& b, Args&&... args)
+    : start(std::min(s, e))
+    , stop(std::max(s, e))
+    , value(std::forward<A>(a), std::forward<B>(b), std::forward<Args>(args)...)
+    {}
 };
 
 template <class Scalar, typename Value>
@@ -34,12 +59,231 @@ Value intervalStop(const Interval<Scalar, Value>& i) {
     return i.stop;
 }
 
+// The point halfway between a <= b, without overflowing even when a + b
+// or b - a does not fit in Scalar.
+template <class Scalar>
+Scalar intervalMidpoint(const Scalar& a, const Scalar& b, std::true_type) {
+    typedef typename std::make_unsigned<Scalar>::type Unsigned;
+    return Scalar(Unsigned(a) + (Unsigned(b) - Unsigned(a)) / 2);
+}
+
+template <class Scalar>
+Scalar intervalMidpoint(const Scalar& a, const Scalar& b, std::false_type) {
+    return a + (b - a) / 2;
+}
+
+template <class Scalar>
+Scalar intervalMidpoint(const Scalar& a, const Scalar& b) {
+    return intervalMidpoint(a, b, std::is_integral<Scalar>());
+}
+
+// The difference b - a of a <= b. For integral Scalars it is computed and
+// returned in the unsigned type, where any such difference fits.
+template <class Scalar, bool = std::is_integral<Scalar>::value>
+struct IntervalDifference {
+    typedef Scalar type;
+
+    static type between(const Scalar& a, const Scalar& b) {
+        return b - a;
+    }
+};
+
+template <class Scalar>
+struct IntervalDifference<Scalar, true> {
+    typedef typename std::make_unsigned<Scalar>::type type;
+
+    static type between(const Scalar& a, const Scalar& b) {
+        return type(type(b) - type(a));
+    }
+};
+
 template <class Scalar, typename Value>
 std::ostream& operator<<(std::ostream& out, const Interval<Scalar, Value>& i) {
     out << "Interval(" << i.start << ", " << i.stop << "): " << i.value;
     return out;
 }
 
+#ifdef INTERVAL_TREE_HAS_COROUTINES
+// A lazily evaluated sequence produced by a coroutine that co_yields
+// Reference values. It can be iterated once; each step resumes the
+// coroutine until its next co_yield.
+template <class Reference>
+class IntervalGenerator {
+public:
+    typedef typename std::remove_reference<Reference>::type element_type;
+
+    struct promise_type {
+        element_type* current = nullptr;
+        std::exception_ptr error;
+
+        IntervalGenerator get_return_object() {
+            return IntervalGenerator(std::coroutine_handle<promise_type>::from_promise(*this));
+        }
+        std::suspend_always initial_suspend() noexcept { return {}; }
+        std::suspend_always final_suspend() noexcept { return {}; }
+        std::suspend_always yield_value(Reference value) noexcept {
+            current = std::addressof(value);
+            return {};
+        }
+        void return_void() {}
+        void unhandled_exception() { error = std::current_exception(); }
+    };
+
+    typedef std::coroutine_handle<promise_type> handle_type;
+
+    class iterator {
+    public:
+        typedef std::input_iterator_tag iterator_category;
+        typedef typename std::remove_cv<element_type>::type value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef element_type* pointer;
+        typedef Reference reference;
+
+        iterator() = default;
+        explicit iterator(handle_type coroutine) : coroutine(coroutine) {}
+
+        reference operator*() const { return static_cast<reference>(*coroutine.promise().current); }
+        pointer operator->() const { return coroutine.promise().current; }
+
+        iterator& operator++() {
+            coroutine.resume();
+            rethrow();
+            return *this;
+        }
+        void operator++(int) { ++*this; }
+
+        bool operator==(std::default_sentinel_t) const { return !coroutine || coroutine.done(); }
+        bool operator!=(std::default_sentinel_t s) const { return !(*this == s); }
+
+        void rethrow() const {
+            if (coroutine.done() && coroutine.promise().error) {
+                std::rethrow_exception(coroutine.promise().error);
+            }
+        }
+
+    private:
+        handle_type coroutine;
+    };
+
+    IntervalGenerator(IntervalGenerator&& other) noexcept : coroutine(other.coroutine) {
+        other.coroutine = nullptr;
+    }
+    IntervalGenerator& operator=(IntervalGenerator&& other) noexcept {
+        if (this != &other) {
+            destroy();
+            coroutine = other.coroutine;
+            other.coroutine = nullptr;
+        }
+        return *this;
+    }
+    IntervalGenerator(const IntervalGenerator&) = delete;
+    IntervalGenerator& operator=(const IntervalGenerator&) = delete;
+    ~IntervalGenerator() { destroy(); }
+
+    iterator begin() {
+        coroutine.resume();
+        iterator i(coroutine);
+        i.rethrow();
+        return i;
+    }
+    std::default_sentinel_t end() const { return std::default_sentinel; }
+
+private:
+    explicit IntervalGenerator(handle_type coroutine) : coroutine(coroutine) {}
+
+    void destroy() {
+        if (coroutine) {
+            coroutine.destroy();
+        }
+    }
+
+    handle_type coroutine;
+};
+#endif
+
+// Counters filled in by the query overloads that take a counters argument.
+// The counter type is a compile-time policy: NoQueryCounters does nothing
+// and compiles away, which is what the plain queries use.
+struct NoQueryCounters {
+    void visitNode() {}
+    void examine() {}
+    void report() {}
+    void prune() {}
+};
+
+struct QueryCounters {
+    std::size_t nodesVisited;
+    // intervals visit_near passed on for filtering
+    std::size_t intervalsExamined;
+    // intervals passed to the caller's function
+    std::size_t intervalsReported;
+    // child subtrees skipped because they lie on the far side of a center
+    std::size_t subtreesPruned;
+
+    QueryCounters() { reset(); }
+
+    void visitNode() { ++nodesVisited; }
+    void examine() { ++intervalsExamined; }
+    void report() { ++intervalsReported; }
+    void prune() { ++subtreesPruned; }
+
+    void reset() {
+        nodesVisited = 0;
+        intervalsExamined = 0;
+        intervalsReported = 0;
+        subtreesPruned = 0;
+    }
+
+    friend std::ostream& operator<<(std::ostream& os, const QueryCounters& c) {
+        return os << "nodes visited: " << c.nodesVisited
+                  << ", intervals examined: " << c.intervalsExamined
+                  << ", intervals reported: " << c.intervalsReported
+                  << ", subtrees pruned: " << c.subtreesPruned;
+    }
+};
+
+// Monoids over interval values for aggregate queries. A monoid has a
+// result_type, an identity(), a lift() from one interval and an
+// associative combine().
+template <class Value>
+struct SumAggregate {
+    typedef Value result_type;
+    result_type identity() const { return result_type(); }
+    template <class Interval>
+    result_type lift(const Interval& i) const { return i.value; }
+    result_type combine(const result_type& a, const result_type& b) const { return a + b; }
+};
+
+struct CountAggregate {
+    typedef std::size_t result_type;
+    result_type identity() const { return 0; }
+    template <class Interval>
+    result_type lift(const Interval&) const { return 1; }
+    result_type combine(result_type a, result_type b) const { return a + b; }
+};
+
+template <class Value>
+struct MinAggregate {
+    typedef Value result_type;
+    result_type identity() const { return std::numeric_limits<Value>::max(); }
+    template <class Interval>
+    result_type lift(const Interval& i) const { return i.value; }
+    result_type combine(const result_type& a, const result_type& b) const {
+        return std::min(a, b);
+    }
+};
+
+template <class Value>
+struct MaxAggregate {
+    typedef Value result_type;
+    result_type identity() const { return std::numeric_limits<Value>::lowest(); }
+    template <class Interval>
+    result_type lift(const Interval& i) const { return i.value; }
+    result_type combine(const result_type& a, const result_type& b) const {
+        return std::max(a, b);
+    }
+};
+
 template <class Scalar, class Value>
 class IntervalTree {
 public:
@@ -63,6 +307,9 @@ public:
         : left(nullptr)
         , right(nullptr)
         , center(0)
+        , minStart(0)
+        , maxStop(0)
+        , count(0)
     {}
 
     ~IntervalTree() = default;
@@ -75,7 +322,10 @@ public:
     :   intervals(other.intervals),
         left(other.left ? other.left->clone() : nullptr),
         right(other.right ? other.right->clone() : nullptr),
-        center(other.center)
+        center(other.center),
+        minStart(other.minStart),
+        maxStop(other.maxStop),
+        count(other.count)
     {}
 
     IntervalTree& operator=(IntervalTree&&) = default;
@@ -83,6 +333,9 @@ public:
 
     IntervalTree& operator=(const IntervalTree& other) {
         center = other.center;
+        minStart = other.minStart;
+        maxStop = other.maxStop;
+        count = other.count;
         intervals = other.intervals;
         left = other.left ? other.left->clone() : nullptr;
         right = other.right ? other.right->clone() : nullptr;
@@ -98,6 +351,10 @@ public:
             Scalar rightextent = 0)
       : left(nullptr)
       , right(nullptr)
+      , center(0)
+      , minStart(0)
+      , maxStop(0)
+      , count(ivals.size())
     {
         --depth;
         const auto minmaxStop = std::minmax_element(ivals.begin(), ivals.end(), 
@@ -105,16 +362,19 @@ public:
         const auto minmaxStart = std::minmax_element(ivals.begin(), ivals.end(), 
                                                      IntervalStartCmp());
         if (!ivals.empty()) {
-            center = (minmaxStart.first->start + minmaxStop.second->stop) / 2;
+            minStart = minmaxStart.first->start;
+            maxStop = minmaxStop.second->stop;
+            center = intervalMidpoint(minStart, maxStop);
         }
         if (leftextent == 0 && rightextent == 0) {
-            // sort intervals by start
-            std::sort(ivals.begin(), ivals.end(), IntervalStartCmp());
+            // sort intervals by start, unless the caller already did
+            if (!std::is_sorted(ivals.begin(), ivals.end(), IntervalStartCmp())) {
+                std::sort(ivals.begin(), ivals.end(), IntervalStartCmp());
+            }
         } else {
             assert(std::is_sorted(ivals.begin(), ivals.end(), IntervalStartCmp()));
         }
         if (depth == 0 || (ivals.size() < minbucket && ivals.size() < maxbucket)) {
-            std::sort(ivals.begin(), ivals.end(), IntervalStartCmp());
             intervals = std::move(ivals);
             assert(is_valid().first);
             return;
@@ -134,19 +394,22 @@ public:
             interval_vector lefts;
             interval_vector rights;
 
-            for (typename interval_vector::const_iterator i = ivals.begin(); 
+            // move rather than copy, so move-only values work and large
+            // values are not copied at every level
+            for (typename interval_vector::iterator i = ivals.begin(); 
                  i != ivals.end(); ++i) {
-                const interval& interval = *i;
+                interval& interval = *i;
                 if (interval.stop < center) {
-                    lefts.push_back(interval);
+                    lefts.push_back(std::move(interval));
                 } else if (interval.start > center) {
-                    rights.push_back(interval);
+                    rights.push_back(std::move(interval));
                 } else {
                     assert(interval.start <= center);
                     assert(center <= interval.stop);
-                    intervals.push_back(interval);
+                    intervals.push_back(std::move(interval));
                 }
             }
+            ivals.clear();
 
             if (!lefts.empty()) {
                 left.reset(new IntervalTree(std::move(lefts), 
@@ -162,19 +425,236 @@ public:
         assert(is_valid().first);
     }
 
+    // Add intervals to a built tree without rebuilding all of it. New
+    // intervals are routed down the existing center splits into the
+    // buckets they belong to. A leaf is split once its bucket reaches
+    // maxbucket, and a subtree is rebuilt only when the batch reaching it
+    // is at least as large as the subtree already is, so each interval
+    // takes part in O(log n) rebuilds over any sequence of batches. depth,
+    // minbucket and maxbucket should be those the tree was built with.
+    void bulkInsert(interval_vector&& ivals,
+                    std::size_t depth = 16,
+                    std::size_t minbucket = 64,
+                    std::size_t maxbucket = 512) {
+        if (ivals.empty()) {
+            return;
+        }
+        if (empty()) {
+            *this = IntervalTree(std::move(ivals), depth, minbucket, maxbucket);
+            return;
+        }
+        if (!std::is_sorted(ivals.begin(), ivals.end(), IntervalStartCmp())) {
+            std::sort(ivals.begin(), ivals.end(), IntervalStartCmp());
+        }
+        insertSorted(std::move(ivals), depth, minbucket, maxbucket);
+        assert(is_valid().first);
+    }
+
+    // Remove every interval for which pred returns true and return how
+    // many were removed. Buckets are compacted in place, keeping their
+    // order, and nodes left with no intervals and no children are freed;
+    // the rest of the tree keeps its shape, so nothing is rebuilt.
+    template <class UnaryPredicate>
+    std::size_t eraseIf(UnaryPredicate pred) {
+        const std::size_t erased = eraseNear(nullptr, nullptr, pred);
+        assert(is_valid().first);
+        return erased;
+    }
+
+    // Remove every interval overlapping [start, stop], only visiting the
+    // nodes a query for [start, stop] would.
+    std::size_t eraseOverlapping(const Scalar& start, const Scalar& stop) {
+        auto overlapping = [&](const interval& interval) {
+            return interval.stop >= start && interval.start <= stop;
+        };
+        const std::size_t erased = eraseNear(&start, &stop, overlapping);
+        assert(is_valid().first);
+        return erased;
+    }
+
+    // Forward iterator over intervals in increasing order of start. It
+    // merges the start-sorted buckets of the nodes that can hold matching
+    // intervals with a heap, one cursor per bucket, and never copies an
+    // interval.
+    class const_iterator {
+    public:
+        typedef std::forward_iterator_tag iterator_category;
+        typedef interval value_type;
+        typedef std::ptrdiff_t difference_type;
+        typedef const interval* pointer;
+        typedef const interval& reference;
+
+        const_iterator()
+            : start()
+            , filtered(false)
+        {}
+
+        reference operator*() const { return *cursors.front().next; }
+        pointer operator->() const { return cursors.front().next; }
+
+        const_iterator& operator++() {
+            advance();
+            skip();
+            return *this;
+        }
+
+        const_iterator operator++(int) {
+            const_iterator previous = *this;
+            ++*this;
+            return previous;
+        }
+
+        bool operator==(const const_iterator& other) const {
+            return cursors.empty() ? other.cursors.empty()
+                : !other.cursors.empty() && cursors.front().next == other.cursors.front().next;
+        }
+
+        bool operator!=(const const_iterator& other) const {
+            return !(*this == other);
+        }
+
+    private:
+        friend class IntervalTree;
+
+        struct Cursor {
+            const interval* next;
+            const interval* end;
+        };
+
+        struct Later {
+            bool operator()(const Cursor& a, const Cursor& b) const {
+                return b.next->start < a.next->start;
+            }
+        };
+
+        // Iterate over every interval of tree.
+        explicit const_iterator(const IntervalTree& tree)
+            : start()
+            , filtered(false)
+        {
+            tree.visit_nodes([&](const IntervalTree& node) {
+                add(node.intervals.data(), node.intervals.data() + node.intervals.size());
+            });
+            std::make_heap(cursors.begin(), cursors.end(), Later());
+        }
+
+        // Iterate over the intervals of tree overlapping [start, stop].
+        const_iterator(const IntervalTree& tree, const Scalar& start, const Scalar& stop)
+            : start(start)
+            , filtered(true)
+        {
+            tree.visit_near_nodes(start, stop, [&](const IntervalTree& node) {
+                // buckets are sorted by start, so only a prefix can overlap
+                const interval* first = node.intervals.data();
+                const interval* last = first + node.intervals.size();
+                add(first, std::upper_bound(first, last, stop,
+                                            [](const Scalar& s, const interval& i) {
+                                                return s < i.start;
+                                            }));
+            });
+            std::make_heap(cursors.begin(), cursors.end(), Later());
+            skip();
+        }
+
+        void add(const interval* first, const interval* last) {
+            if (first != last) {
+                cursors.push_back(Cursor{ first, last });
+            }
+        }
+
+        void advance() {
+            std::pop_heap(cursors.begin(), cursors.end(), Later());
+            if (++cursors.back().next == cursors.back().end) {
+                cursors.pop_back();
+            } else {
+                std::push_heap(cursors.begin(), cursors.end(), Later());
+            }
+        }
+
+        // move past intervals that end before the query starts
+        void skip() {
+            while (filtered && !cursors.empty() && cursors.front().next->stop < start) {
+                advance();
+            }
+        }
+
+        std::vector<Cursor> cursors;
+        Scalar start;
+        bool filtered;
+    };
+
+    // A pair of iterators usable in a range-based for loop.
+    class const_range {
+    public:
+        const_range(const_iterator first, const_iterator last)
+            : first(first)
+            , last(last)
+        {}
+
+        const_iterator begin() const { return first; }
+        const_iterator end() const { return last; }
+
+    private:
+        const_iterator first;
+        const_iterator last;
+    };
+
+    const_iterator begin() const {
+        return const_iterator(*this);
+    }
+
+    const_iterator end() const {
+        return const_iterator();
+    }
+
+    // The intervals overlapping [start, stop], in increasing order of start.
+    const_range overlapping_range(const Scalar& start, const Scalar& stop) const {
+        return const_range(const_iterator(*this, start, stop), const_iterator());
+    }
+
+#ifdef INTERVAL_TREE_HAS_COROUTINES
+    typedef IntervalGenerator<const interval&> generator;
+
+    // The intervals overlapping [start, stop] in increasing order of start,
+    // produced one at a time as the caller asks for them. The tree must
+    // outlive the generator.
+    generator overlapping(Scalar start, Scalar stop) const {
+        for (const interval& interval : overlapping_range(start, stop)) {
+            co_yield interval;
+        }
+    }
+#endif
+
     // Call f on all intervals near the range [start, stop]:
     template <class UnaryFunction>
     void visit_near(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        NoQueryCounters counters;
+        visit_near(start, stop, f, counters);
+    }
+
+    template <class UnaryFunction, class Counters>
+    void visit_near(const Scalar& start, const Scalar& stop, UnaryFunction f,
+                    Counters& counters) const {
+        counters.visitNode();
         if (!intervals.empty() && ! (stop < intervals.front().start)) {
             for (auto & i : intervals) {
+              counters.examine();
               f(i);
             }
         }
-        if (left && start <= center) {
-            left->visit_near(start, stop, f);
+        if (left) {
+            if (start <= center) {
+                left->visit_near(start, stop, f, counters);
+            } else {
+                counters.prune();
+            }
         }
-        if (right && stop >= center) {
-            right->visit_near(start, stop, f);
+        if (right) {
+            if (stop >= center) {
+                right->visit_near(start, stop, f, counters);
+            } else {
+                counters.prune();
+            }
         }
     }
 
@@ -187,24 +667,40 @@ public:
     // Call f on all intervals overlapping [start, stop]
     template <class UnaryFunction>
     void visit_overlapping(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        NoQueryCounters counters;
+        visit_overlapping(start, stop, f, counters);
+    }
+
+    template <class UnaryFunction, class Counters>
+    void visit_overlapping(const Scalar& start, const Scalar& stop, UnaryFunction f,
+                           Counters& counters) const {
         auto filterF = [&](const interval& interval) {
             if (interval.stop >= start && interval.start <= stop) {
                 // Only apply f if overlapping
+                counters.report();
                 f(interval);
             }
         };
-        visit_near(start, stop, filterF);
+        visit_near(start, stop, filterF, counters);
     }
 
     // Call f on all intervals contained within [start, stop]
     template <class UnaryFunction>
     void visit_contained(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        NoQueryCounters counters;
+        visit_contained(start, stop, f, counters);
+    }
+
+    template <class UnaryFunction, class Counters>
+    void visit_contained(const Scalar& start, const Scalar& stop, UnaryFunction f,
+                         Counters& counters) const {
         auto filterF = [&](const interval& interval) {
             if (start <= interval.start && interval.stop <= stop) {
+                counters.report();
                 f(interval);
             }
         };
-        visit_near(start, stop, filterF);
+        visit_near(start, stop, filterF, counters);
     }
 
     interval_vector findOverlapping(const Scalar& start, const Scalar& stop) const {
@@ -224,6 +720,403 @@ public:
                         });
         return result;
     }
+
+    // Call f(q, interval) for every interval overlapping queries[q], where
+    // each query has start and stop members (an interval_vector works).
+    // Up to group queries are walked at once, taking turns one node at a
+    // time: a step prefetches the buckets and children of the node it
+    // descends into and scans them on the query's next turn, so memory
+    // latency overlaps with the work of the other queries. Each query
+    // reports its intervals in the same order as visit_overlapping.
+    template <class Queries, class BinaryFunction>
+    void visit_overlapping_batch(const Queries& queries, BinaryFunction f,
+                                 std::size_t group = 16) const {
+        struct Lane {
+            std::size_t query;
+            Scalar start;
+            Scalar stop;
+            // node whose bucket was prefetched on the previous turn
+            const IntervalTree* scan;
+            std::vector<const IntervalTree*> stack;
+        };
+        std::vector<Lane> lanes(std::max<std::size_t>(group, 1));
+        auto next = std::begin(queries);
+        const auto last = std::end(queries);
+        std::size_t q = 0;
+        auto begin = [&](Lane& lane) {
+            if (next == last) {
+                return false;
+            }
+            lane.query = q++;
+            lane.start = next->start;
+            lane.stop = next->stop;
+            lane.scan = nullptr;
+            lane.stack.clear();
+            lane.stack.push_back(this);
+            ++next;
+            return true;
+        };
+
+        std::size_t active = 0;
+        while (active != lanes.size() && begin(lanes[active])) {
+            ++active;
+        }
+        while (active != 0) {
+            for (std::size_t l = 0; l != active; ) {
+                Lane& lane = lanes[l];
+                if (lane.scan) {
+                    for (const interval& i : lane.scan->intervals) {
+                        if (i.stop >= lane.start && i.start <= lane.stop) {
+                            f(lane.query, i);
+                        }
+                    }
+                    lane.scan = nullptr;
+                }
+                if (!lane.stack.empty()) {
+                    const IntervalTree* node = lane.stack.back();
+                    lane.stack.pop_back();
+                    if (!node->intervals.empty()
+                        && ! (lane.stop < node->intervals.front().start)) {
+                        prefetch(node->intervals.data());
+                        lane.scan = node;
+                    }
+                    // right first, so the left subtree is walked first as in visit_near
+                    if (node->right && lane.stop >= node->center) {
+                        prefetch(node->right.get());
+                        lane.stack.push_back(node->right.get());
+                    }
+                    if (node->left && lane.start <= node->center) {
+                        prefetch(node->left.get());
+                        lane.stack.push_back(node->left.get());
+                    }
+                }
+                if (lane.scan || !lane.stack.empty() || begin(lane)) {
+                    ++l;
+                } else {
+                    std::swap(lane, lanes[--active]);
+                }
+            }
+        }
+    }
+
+    // Call f on the k intervals closest to pos, nearest first. Intervals
+    // containing pos are at distance 0; ties are broken arbitrarily.
+    template <class UnaryFunction>
+    void visit_nearest(const Scalar& pos, std::size_t k, UnaryFunction f) const {
+        // best-first search: a subtree is queued at the distance from pos to
+        // its extent, which no interval inside it can beat
+        struct Candidate {
+            typename IntervalDifference<Scalar>::type distance;
+            const IntervalTree* node;
+            const interval* hit;
+            bool operator<(const Candidate& other) const {
+                return other.distance < distance;
+            }
+        };
+        if (k == 0 || (intervals.empty() && !left && !right)) {
+            return;
+        }
+        std::priority_queue<Candidate> queue;
+        queue.push(Candidate{ distance(pos, minStart, maxStop), this, nullptr });
+        while (!queue.empty()) {
+            const Candidate next = queue.top();
+            queue.pop();
+            if (next.hit) {
+                f(*next.hit);
+                if (--k == 0) {
+                    return;
+                }
+                continue;
+            }
+            const IntervalTree& node = *next.node;
+            for (const interval& i : node.intervals) {
+                queue.push(Candidate{ distance(pos, i.start, i.stop), nullptr, &i });
+            }
+            if (node.left) {
+                queue.push(Candidate{ distance(pos, node.left->minStart, node.left->maxStop),
+                                      node.left.get(), nullptr });
+            }
+            if (node.right) {
+                queue.push(Candidate{ distance(pos, node.right->minStart, node.right->maxStop),
+                                      node.right.get(), nullptr });
+            }
+        }
+    }
+
+    interval_vector findNearest(const Scalar& pos, std::size_t k) const {
+        interval_vector result;
+        visit_nearest(pos, k,
+                      [&](const interval& interval) {
+                        result.push_back(interval);
+                      });
+        return result;
+    }
+
+    // Distance from pos to the closed range [start, stop].
+    static typename IntervalDifference<Scalar>::type
+    distance(const Scalar& pos, const Scalar& start, const Scalar& stop) {
+        if (pos < start) {
+            return IntervalDifference<Scalar>::between(pos, start);
+        }
+        if (stop < pos) {
+            return IntervalDifference<Scalar>::between(stop, pos);
+        }
+        return typename IntervalDifference<Scalar>::type();
+    }
+
+    // Call f(segmentStart, segmentStop, depth) for consecutive segments
+    // covering [start, stop], where depth is the number of intervals
+    // overlapping every position of the segment. Adjacent segments have
+    // different depths. Requires integral coordinates.
+    template <class Function>
+    void coverage(const Scalar& start, const Scalar& stop, Function f) const {
+        static_assert(std::is_integral<Scalar>::value,
+                      "coverage requires integral coordinates");
+        if (stop < start) {
+            return;
+        }
+        // sweep over the overlapping intervals in start order, clipped to
+        // start: +1 at each start, -1 just past each stop. Only the ends of
+        // the intervals still open are held, in a min-heap.
+        std::priority_queue<Scalar, std::vector<Scalar>, std::greater<Scalar> > ends;
+        const const_range range = overlapping_range(start, stop);
+        const_iterator next = range.begin();
+        const const_iterator last = range.end();
+        Scalar pos = start;
+        std::size_t depth = 0;
+        while (next != last || !ends.empty()) {
+            Scalar at = next == last ? ends.top() : std::max(next->start, start);
+            if (!ends.empty() && ends.top() < at) {
+                at = ends.top();
+            }
+            std::size_t nextDepth = depth;
+            for (; next != last && std::max(next->start, start) == at; ++next) {
+                ++nextDepth;
+                if (next->stop < stop) {
+                    ends.push(next->stop + 1);
+                }
+            }
+            for (; !ends.empty() && ends.top() == at; ends.pop()) {
+                --nextDepth;
+            }
+            if (nextDepth != depth) {
+                if (pos < at) {
+                    f(pos, Scalar(at - 1), depth);
+                }
+                pos = at;
+                depth = nextDepth;
+            }
+        }
+        f(pos, stop, depth);
+    }
+
+    // Combine monoid.lift(i) over every interval i overlapping [start, stop].
+    // This visits every overlapping interval; to aggregate the same tree
+    // many times use an Aggregator.
+    template <class Monoid>
+    typename Monoid::result_type aggregateOverlapping(const Scalar& start, const Scalar& stop,
+                                                      const Monoid& monoid = Monoid()) const {
+        typename Monoid::result_type result = monoid.identity();
+        visit_overlapping(start, stop, [&](const interval& interval) {
+            result = monoid.combine(result, monoid.lift(interval));
+        });
+        return result;
+    }
+
+    // Aggregates of a monoid precomputed for every node bucket and subtree,
+    // so that buckets and subtrees whose intervals all overlap the query
+    // contribute their cached aggregate instead of being visited. An
+    // Aggregator refers to its tree and is invalidated when the tree is
+    // modified or moved.
+    template <class Monoid>
+    class Aggregator {
+    public:
+        typedef typename Monoid::result_type result_type;
+
+        Aggregator(const IntervalTree& tree, const Monoid& monoid = Monoid())
+            : monoid(monoid)
+            , tree(&tree)
+            , root(build(tree))
+        {}
+
+        // Combine monoid.lift(i) over every interval i overlapping [start, stop]
+        result_type aggregateOverlapping(const Scalar& start, const Scalar& stop) const {
+            return aggregate(*tree, *root, start, stop);
+        }
+
+    private:
+        struct Node {
+            // aggregate and endpoint bounds of the node's own bucket ...
+            result_type bucket;
+            Scalar bucketMaxStart;
+            Scalar bucketMinStop;
+            // ... and of its whole subtree
+            result_type subtree;
+            std::size_t count;
+            Scalar minStart;
+            Scalar maxStart;
+            Scalar minStop;
+            Scalar maxStop;
+            std::unique_ptr<Node> left;
+            std::unique_ptr<Node> right;
+        };
+
+        std::unique_ptr<Node> build(const IntervalTree& t) const {
+            std::unique_ptr<Node> node(new Node());
+            node->bucket = monoid.identity();
+            node->count = t.intervals.size();
+            for (const interval& i : t.intervals) {
+                node->bucket = monoid.combine(node->bucket, monoid.lift(i));
+                if (&i == &t.intervals.front()) {
+                    node->bucketMaxStart = i.start;
+                    node->bucketMinStop = i.stop;
+                    node->maxStop = i.stop;
+                } else {
+                    node->bucketMaxStart = std::max(node->bucketMaxStart, i.start);
+                    node->bucketMinStop = std::min(node->bucketMinStop, i.stop);
+                    node->maxStop = std::max(node->maxStop, i.stop);
+                }
+            }
+            if (node->count) {
+                node->minStart = t.intervals.front().start;
+                node->maxStart = node->bucketMaxStart;
+                node->minStop = node->bucketMinStop;
+            }
+            node->subtree = node->bucket;
+            if (t.left) {
+                node->left = build(*t.left);
+                include(*node, *node->left);
+            }
+            if (t.right) {
+                node->right = build(*t.right);
+                include(*node, *node->right);
+            }
+            return node;
+        }
+
+        void include(Node& node, const Node& child) const {
+            if (!child.count) {
+                return;
+            }
+            node.subtree = monoid.combine(node.subtree, child.subtree);
+            if (!node.count) {
+                node.minStart = child.minStart;
+                node.maxStart = child.maxStart;
+                node.minStop = child.minStop;
+                node.maxStop = child.maxStop;
+            } else {
+                node.minStart = std::min(node.minStart, child.minStart);
+                node.maxStart = std::max(node.maxStart, child.maxStart);
+                node.minStop = std::min(node.minStop, child.minStop);
+                node.maxStop = std::max(node.maxStop, child.maxStop);
+            }
+            node.count += child.count;
+        }
+
+        result_type aggregate(const IntervalTree& t, const Node& node,
+                              const Scalar& start, const Scalar& stop) const {
+            if (!node.count || stop < node.minStart || node.maxStop < start) {
+                return monoid.identity();
+            }
+            // every interval [a, b] of the subtree has a <= maxStart <= stop
+            // and b >= minStop >= start, so all of them overlap
+            if (node.maxStart <= stop && start <= node.minStop) {
+                return node.subtree;
+            }
+            result_type result = monoid.identity();
+            if (!t.intervals.empty()) {
+                if (node.bucketMaxStart <= stop && start <= node.bucketMinStop) {
+                    result = node.bucket;
+                } else {
+                    for (const interval& i : t.intervals) {
+                        if (stop < i.start) {
+                            break;
+                        }
+                        if (i.stop >= start) {
+                            result = monoid.combine(result, monoid.lift(i));
+                        }
+                    }
+                }
+            }
+            if (node.left) {
+                result = monoid.combine(result, aggregate(*t.left, *node.left, start, stop));
+            }
+            if (node.right) {
+                result = monoid.combine(result, aggregate(*t.right, *node.right, start, stop));
+            }
+            return result;
+        }
+
+        Monoid monoid;
+        const IntervalTree* tree;
+        std::unique_ptr<Node> root;
+    };
+
+    template <class Monoid>
+    Aggregator<Monoid> aggregator(const Monoid& monoid = Monoid()) const {
+        return Aggregator<Monoid>(*this, monoid);
+    }
+
+    // Call f(gapStart, gapStop) for each maximal sub-range of [start, stop]
+    // not covered by any interval, in increasing order. Requires integral
+    // coordinates.
+    template <class BinaryFunction>
+    void visit_gaps(const Scalar& start, const Scalar& stop, BinaryFunction f) const {
+        static_assert(std::is_integral<Scalar>::value,
+                      "visit_gaps requires integral coordinates");
+        if (stop < start) {
+            return;
+        }
+        Scalar uncovered = start;
+        for (const interval& interval : overlapping_range(start, stop)) {
+            if (uncovered < interval.start) {
+                f(uncovered, Scalar(interval.start - 1));
+            }
+            if (!(interval.stop < uncovered)) {
+                if (!(interval.stop < stop)) {
+                    return;
+                }
+                uncovered = interval.stop + 1;
+            }
+        }
+        f(uncovered, stop);
+    }
+
+    // Call f(mergedStart, mergedStop) for the union of the intervals
+    // overlapping [start, stop], as disjoint ranges in increasing order.
+    // Intervals are also merged when the gap between them (the next start
+    // minus the current stop) is at most tolerance; with integral
+    // coordinates a tolerance of 1 merges book-ended intervals.
+    template <class BinaryFunction>
+    void visit_merged(const Scalar& start, const Scalar& stop, BinaryFunction f,
+                      const Scalar& tolerance = Scalar()) const {
+        typedef IntervalDifference<Scalar> Difference;
+        // gaps are compared as unsigned differences, which cannot overflow
+        const bool tolerant = !(tolerance < Scalar());
+        const typename Difference::type maxGap =
+            tolerant ? Difference::between(Scalar(), tolerance) : typename Difference::type();
+        bool open = false;
+        Scalar mergedStart = Scalar();
+        Scalar mergedStop = Scalar();
+        for (const interval& interval : overlapping_range(start, stop)) {
+            if (open && (!(mergedStop < interval.start)
+                         || (tolerant
+                             && !(maxGap < Difference::between(mergedStop, interval.start))))) {
+                mergedStop = std::max(mergedStop, interval.stop);
+                continue;
+            }
+            if (open) {
+                f(mergedStart, mergedStop);
+            }
+            open = true;
+            mergedStart = interval.start;
+            mergedStop = interval.stop;
+        }
+        if (open) {
+            f(mergedStart, mergedStop);
+        }
+    }
+
     bool empty() const {
         if (left && !left->empty()) {
             return false;
@@ -248,6 +1141,59 @@ public:
         }
     }
 
+    // Shape and memory use of a tree, as returned by stats().
+    struct Stats {
+        std::size_t nodes;
+        std::size_t leaves;
+        std::size_t intervals;
+        // intervals stored at inner nodes, which all span the node's center
+        std::size_t centerSpanning;
+        std::size_t depth;
+        std::vector<std::size_t> nodesPerLevel;
+        std::vector<std::size_t> intervalsPerLevel;
+        // bucketSizes[0] counts empty buckets and bucketSizes[k] buckets
+        // holding [2^(k-1), 2^k) intervals
+        std::vector<std::size_t> bucketSizes;
+        // node objects plus bucket capacity, of which slackBytes are unused
+        std::size_t bytes;
+        std::size_t slackBytes;
+
+        Stats()
+            : nodes(0)
+            , leaves(0)
+            , intervals(0)
+            , centerSpanning(0)
+            , depth(0)
+            , bytes(0)
+            , slackBytes(0)
+        {}
+
+        friend std::ostream& operator<<(std::ostream& os, const Stats& stats) {
+            auto list = [&](const std::vector<std::size_t>& v) {
+                for (std::size_t i = 0; i != v.size(); ++i) {
+                    os << (i ? "," : "") << v[i];
+                }
+            };
+            os << "nodes: " << stats.nodes << '\n'
+               << "leaves: " << stats.leaves << '\n'
+               << "intervals: " << stats.intervals << '\n'
+               << "center spanning: " << stats.centerSpanning << '\n'
+               << "depth: " << stats.depth << '\n'
+               << "nodes per level: "; list(stats.nodesPerLevel);
+            os << '\n' << "intervals per level: "; list(stats.intervalsPerLevel);
+            os << '\n' << "bucket sizes (log2 bins): "; list(stats.bucketSizes);
+            os << '\n' << "bytes: " << stats.bytes << '\n'
+               << "slack bytes: " << stats.slackBytes << '\n';
+            return os;
+        }
+    };
+
+    Stats stats() const {
+        Stats result;
+        collectStats(result, 0);
+        return result;
+    }
+
     std::pair<Scalar, Scalar> extentBruitForce() const {
         struct Extent {
             std::pair<Scalar, Scalar> x = {std::numeric_limits<Scalar>::max(),
@@ -302,6 +1248,9 @@ public:
         if (!std::is_sorted(intervals.begin(), intervals.end(), IntervalStartCmp())) {
             result.first = false;
         }
+        if (count != intervals.size() + (left ? left->count : 0) + (right ? right->count : 0)) {
+            result.first = false;
+        }
         return result;        
     }
 
@@ -332,10 +1281,226 @@ public:
     }
 
 private:
+    template <class S, class V> friend struct IntervalTreeIndexBuilder;
+    template <class S, class V> friend class CompressedIntervalTree;
+
+    static void prefetch(const void* p) {
+#if defined(__GNUC__)
+        __builtin_prefetch(p);
+#else
+        (void)p;
+#endif
+    }
+
+    // Call f on every node.
+    template <class NodeFunction>
+    void visit_nodes(NodeFunction&& f) const {
+        f(*this);
+        if (left) {
+            left->visit_nodes(f);
+        }
+        if (right) {
+            right->visit_nodes(f);
+        }
+    }
+
+    // Call f on the nodes whose bucket visit_near would scan.
+    template <class NodeFunction>
+    void visit_near_nodes(const Scalar& start, const Scalar& stop, NodeFunction&& f) const {
+        if (!intervals.empty() && ! (stop < intervals.front().start)) {
+            f(*this);
+        }
+        if (left && start <= center) {
+            left->visit_near_nodes(start, stop, f);
+        }
+        if (right && stop >= center) {
+            right->visit_near_nodes(start, stop, f);
+        }
+    }
+
+    // Remove the intervals matching pred from the nodes near [*start,
+    // *stop]; a null bound leaves that side unbounded.
+    template <class UnaryPredicate>
+    std::size_t eraseNear(const Scalar* start, const Scalar* stop, UnaryPredicate& pred) {
+        std::size_t erased = 0;
+        if (!intervals.empty() && !(stop && *stop < intervals.front().start)) {
+            const auto kept = std::remove_if(intervals.begin(), intervals.end(),
+                                             [&](const interval& i) { return pred(i); });
+            erased += intervals.end() - kept;
+            intervals.erase(kept, intervals.end());
+        }
+        if (left && (!start || *start <= center)) {
+            erased += left->eraseNear(start, stop, pred);
+            if (left->intervals.empty() && !left->left && !left->right) {
+                left.reset();
+            }
+        }
+        if (right && (!stop || *stop >= center)) {
+            erased += right->eraseNear(start, stop, pred);
+            if (right->intervals.empty() && !right->left && !right->right) {
+                right.reset();
+            }
+        }
+        if (erased != 0) {
+            count -= erased;
+            updateExtent();
+        }
+        return erased;
+    }
+
+    // Recompute minStart and maxStop from the bucket and the children.
+    void updateExtent() {
+        bool any = !intervals.empty();
+        if (any) {
+            minStart = intervals.front().start;
+            maxStop = intervals.front().stop;
+            for (const interval& i : intervals) {
+                maxStop = std::max(maxStop, i.stop);
+            }
+        }
+        for (const IntervalTree* child : { left.get(), right.get() }) {
+            if (child) {
+                minStart = any ? std::min(minStart, child->minStart) : child->minStart;
+                maxStop = any ? std::max(maxStop, child->maxStop) : child->maxStop;
+                any = true;
+            }
+        }
+        if (!any) {
+            minStart = 0;
+            maxStop = 0;
+        }
+    }
+
+    // Merge start-sorted ivals into the subtree at this node, which was
+    // built with the given depth.
+    void insertSorted(interval_vector&& ivals, std::size_t depth,
+                      std::size_t minbucket, std::size_t maxbucket) {
+        Scalar newMaxStop = ivals.front().stop;
+        for (const interval& i : ivals) {
+            newMaxStop = std::max(newMaxStop, i.stop);
+        }
+        const bool wasEmpty = intervals.empty() && !left && !right;
+        minStart = wasEmpty ? ivals.front().start : std::min(minStart, ivals.front().start);
+        maxStop = wasEmpty ? newMaxStop : std::max(maxStop, newMaxStop);
+
+        count += ivals.size();
+        if (!left && !right) {
+            mergeIntoBucket(std::move(ivals));
+            if (depth > 1 && intervals.size() >= maxbucket) {
+                interval_vector all(std::move(intervals));
+                *this = IntervalTree(std::move(all), depth, minbucket, maxbucket);
+            } else {
+                center = intervalMidpoint(minStart, maxStop);
+            }
+            return;
+        }
+        const std::size_t existing = count - ivals.size();
+        if (ivals.size() >= existing) {
+            interval_vector all;
+            all.reserve(existing + ivals.size());
+            moveIntervals(all);
+            all.insert(all.end(), std::make_move_iterator(ivals.begin()),
+                       std::make_move_iterator(ivals.end()));
+            *this = IntervalTree(std::move(all), depth, minbucket, maxbucket);
+            return;
+        }
+
+        interval_vector lefts;
+        interval_vector rights;
+        interval_vector centers;
+        for (interval& i : ivals) {
+            if (i.stop < center) {
+                lefts.push_back(std::move(i));
+            } else if (i.start > center) {
+                rights.push_back(std::move(i));
+            } else {
+                centers.push_back(std::move(i));
+            }
+        }
+        if (!centers.empty()) {
+            mergeIntoBucket(std::move(centers));
+        }
+        const std::size_t childDepth = depth > 1 ? depth - 1 : 1;
+        if (!lefts.empty()) {
+            if (left) {
+                left->insertSorted(std::move(lefts), childDepth, minbucket, maxbucket);
+            } else {
+                left.reset(new IntervalTree(std::move(lefts), childDepth, minbucket, maxbucket));
+            }
+        }
+        if (!rights.empty()) {
+            if (right) {
+                right->insertSorted(std::move(rights), childDepth, minbucket, maxbucket);
+            } else {
+                right.reset(new IntervalTree(std::move(rights), childDepth, minbucket, maxbucket));
+            }
+        }
+    }
+
+    // Merge start-sorted ivals into this node's bucket, keeping it sorted.
+    void mergeIntoBucket(interval_vector&& ivals) {
+        const std::size_t old = intervals.size();
+        intervals.insert(intervals.end(), std::make_move_iterator(ivals.begin()),
+                         std::make_move_iterator(ivals.end()));
+        std::inplace_merge(intervals.begin(), intervals.begin() + old, intervals.end(),
+                           IntervalStartCmp());
+    }
+
+    // Move every interval of the subtree to the end of out.
+    void moveIntervals(interval_vector& out) {
+        out.insert(out.end(), std::make_move_iterator(intervals.begin()),
+                   std::make_move_iterator(intervals.end()));
+        intervals.clear();
+        if (left) {
+            left->moveIntervals(out);
+        }
+        if (right) {
+            right->moveIntervals(out);
+        }
+    }
+
+    void collectStats(Stats& stats, std::size_t level) const {
+        ++stats.nodes;
+        stats.intervals += intervals.size();
+        stats.depth = std::max(stats.depth, level + 1);
+        if (stats.nodesPerLevel.size() <= level) {
+            stats.nodesPerLevel.resize(level + 1);
+            stats.intervalsPerLevel.resize(level + 1);
+        }
+        ++stats.nodesPerLevel[level];
+        stats.intervalsPerLevel[level] += intervals.size();
+        if (left || right) {
+            stats.centerSpanning += intervals.size();
+        } else {
+            ++stats.leaves;
+        }
+        std::size_t bin = 0;
+        for (std::size_t n = intervals.size(); n != 0; n >>= 1) {
+            ++bin;
+        }
+        if (stats.bucketSizes.size() <= bin) {
+            stats.bucketSizes.resize(bin + 1);
+        }
+        ++stats.bucketSizes[bin];
+        stats.bytes += sizeof(IntervalTree) + intervals.capacity() * sizeof(interval);
+        stats.slackBytes += (intervals.capacity() - intervals.size()) * sizeof(interval);
+        if (left) {
+            left->collectStats(stats, level + 1);
+        }
+        if (right) {
+            right->collectStats(stats, level + 1);
+        }
+    }
+
     interval_vector intervals;
     std::unique_ptr<IntervalTree> left;
     std::unique_ptr<IntervalTree> right;
     Scalar center;
+    // smallest start and largest stop in this subtree
+    Scalar minStart;
+    Scalar maxStop;
+    // number of intervals in this subtree
+    std::size_t count;
 };
 #ifdef USE_INTERVAL_TREE_NAMESPACE
 }
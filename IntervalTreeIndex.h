@@ -0,0 +1,768 @@
+#ifndef __INTERVAL_TREE_INDEX_H
+#define __INTERVAL_TREE_INDEX_H
+
+#include <algorithm>
+#include <cstdint>
+#include <cstring>
+#include <fstream>
+#include <list>
+#include <memory>
+#include <mutex>
+#include <stdexcept>
+#include <string>
+#include <type_traits>
+#include <unordered_map>
+#include <vector>
+
+#include "IntervalTree.h"
+#include "MappedFile.h"
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+namespace interval_tree {
+#endif
+
+// On-disk layout of a flattened IntervalTree:
+//
+//   IndexHeader | padding | IndexNode[nodeCount] | padding | interval[intervalCount]
+//
+// Children are referred to by node index and node buckets by a range into
+// the interval array, so the file can be mapped at any address and queried
+// in place. Integers and intervals are stored in native byte order and
+// layout; the header records enough to reject files written by an
+// incompatible build.
+struct IndexHeader {
+    char magic[8];
+    std::uint32_t version;
+    std::uint32_t byteOrder;
+    std::uint32_t scalarSize;
+    std::uint32_t intervalSize;
+    std::uint64_t nodeCount;
+    std::uint64_t intervalCount;
+    std::uint64_t root;
+    std::uint64_t nodesOffset;
+    std::uint64_t intervalsOffset;
+};
+
+static const char indexMagic[8] = { 'I', 'T', 'R', 'E', 'E', 'I', 'D', 'X' };
+static const std::uint32_t indexVersion = 1;
+static const std::uint32_t indexByteOrder = 0x01020304;
+static const std::uint64_t indexNone = ~std::uint64_t(0);
+static const std::uint64_t indexAlignment = 64;
+
+template <class Scalar>
+struct IndexNode {
+    Scalar center;
+    Scalar first;           // start of the bucket's first interval
+    std::uint64_t begin;
+    std::uint64_t end;
+    std::uint64_t left;
+    std::uint64_t right;
+};
+
+inline std::uint64_t indexAlign(std::uint64_t offset) {
+    return (offset + indexAlignment - 1) / indexAlignment * indexAlignment;
+}
+
+// Throw unless header describes an index of intervals of type Interval
+// that fits in size bytes, with each array aligned for its type.
+template <class Scalar, class Interval>
+void checkIndexHeader(const IndexHeader& header, std::uint64_t size) {
+    if (std::memcmp(header.magic, indexMagic, sizeof(header.magic)) != 0) {
+        throw std::runtime_error("not an interval tree index");
+    }
+    if (header.version != indexVersion || header.byteOrder != indexByteOrder
+        || header.scalarSize != sizeof(Scalar)
+        || header.intervalSize != sizeof(Interval)) {
+        throw std::runtime_error("interval tree index was written for a different "
+                                 "version, platform or interval type");
+    }
+    // sizes are checked by division so that corrupt counts cannot overflow
+    if (header.nodesOffset < sizeof(IndexHeader) || header.nodesOffset > size
+        || header.nodeCount > (size - header.nodesOffset) / sizeof(IndexNode<Scalar>)
+        || header.intervalsOffset < sizeof(IndexHeader) || header.intervalsOffset > size
+        || header.intervalCount > (size - header.intervalsOffset) / sizeof(Interval)) {
+        throw std::runtime_error("interval tree index is truncated");
+    }
+    if (header.nodesOffset % alignof(IndexNode<Scalar>) != 0
+        || header.intervalsOffset % alignof(Interval) != 0
+        || (header.nodeCount == 0 ? header.root != indexNone
+                                  : header.root >= header.nodeCount)) {
+        throw std::runtime_error("interval tree index is corrupt");
+    }
+}
+
+// Throw unless node n's bucket lies within the interval array and its
+// children lie after it in the node array, where every layout puts them.
+// Nodes that pass can be followed from the root without reading out of
+// bounds or looping, so a reader can check each node as it reads it.
+template <class Scalar>
+void checkIndexNode(const IndexNode<Scalar>& node, std::uint64_t n, std::uint64_t nodeCount,
+                    std::uint64_t intervalCount) {
+    if (node.begin > node.end || node.end > intervalCount
+        || (node.left != indexNone && (node.left <= n || node.left >= nodeCount))
+        || (node.right != indexNone && (node.right <= n || node.right >= nodeCount))) {
+        throw std::runtime_error("interval tree index is corrupt");
+    }
+}
+
+// Throw unless the nodes form a tree below root whose buckets lie within
+// the interval array, so that queries cannot read out of bounds or loop.
+template <class Scalar>
+void checkIndexNodes(const IndexNode<Scalar>* nodes, std::uint64_t nodeCount,
+                     std::uint64_t root, std::uint64_t intervalCount) {
+    std::vector<bool> seen(nodeCount);
+    std::vector<std::uint64_t> pending;
+    if (root != indexNone) {
+        pending.push_back(root);
+    }
+    while (!pending.empty()) {
+        const std::uint64_t n = pending.back();
+        pending.pop_back();
+        if (n >= nodeCount || seen[n]) {
+            throw std::runtime_error("interval tree index is corrupt");
+        }
+        seen[n] = true;
+        const IndexNode<Scalar>& node = nodes[n];
+        checkIndexNode(node, n, nodeCount, intervalCount);
+        if (node.left != indexNone) {
+            pending.push_back(node.left);
+        }
+        if (node.right != indexNone) {
+            pending.push_back(node.right);
+        }
+    }
+}
+
+// Order of the nodes in the node array. Node buckets are stored in the
+// same order. A query walks one or more root-to-leaf paths:
+//  - PreorderLayout puts each left child right after its parent
+//  - BreadthFirstLayout stores the tree level by level (Eytzinger order),
+//    keeping the top levels, which every query touches, together
+//  - VanEmdeBoasLayout recursively stores the top half of the levels
+//    before each bottom subtree, so a path crosses O(log n / log B) blocks
+//    for any cache line or page size B
+enum IndexLayout {
+    PreorderLayout,
+    BreadthFirstLayout,
+    VanEmdeBoasLayout
+};
+
+// Flattens an IntervalTree into the index layout, with the nodes in the
+// given order and each node's bucket stored contiguously.
+template <class Scalar, class Value>
+struct IntervalTreeIndexBuilder {
+    typedef IntervalTree<Scalar, Value> tree_type;
+    typedef typename tree_type::interval interval;
+    typedef IndexNode<Scalar> node_type;
+
+    static_assert(std::is_trivially_copyable<interval>::value,
+                  "an interval tree index requires trivially copyable intervals");
+
+    static void write(std::ostream& os, const tree_type& tree,
+                      IndexLayout layout = VanEmdeBoasLayout) {
+        std::vector<const tree_type*> order;
+        if (!tree.empty()) {
+            switch (layout) {
+            case PreorderLayout:
+                preorder(&tree, order);
+                break;
+            case BreadthFirstLayout:
+                breadthFirst(&tree, order);
+                break;
+            case VanEmdeBoasLayout:
+                vanEmdeBoas(&tree, height(&tree), order);
+                break;
+            }
+        }
+
+        std::unordered_map<const tree_type*, std::uint64_t> number;
+        for (std::size_t n = 0; n != order.size(); ++n) {
+            number[order[n]] = n;
+        }
+        std::vector<node_type> nodes(order.size());
+        std::uint64_t intervalCount = 0;
+        for (std::size_t n = 0; n != order.size(); ++n) {
+            const tree_type* t = order[n];
+            nodes[n].center = t->center;
+            nodes[n].first = t->intervals.empty() ? Scalar() : t->intervals.front().start;
+            nodes[n].begin = intervalCount;
+            intervalCount += t->intervals.size();
+            nodes[n].end = intervalCount;
+            nodes[n].left = t->left ? number[t->left.get()] : indexNone;
+            nodes[n].right = t->right ? number[t->right.get()] : indexNone;
+        }
+
+        IndexHeader header;
+        std::memset(&header, 0, sizeof(header));
+        std::memcpy(header.magic, indexMagic, sizeof(header.magic));
+        header.version = indexVersion;
+        header.byteOrder = indexByteOrder;
+        header.scalarSize = sizeof(Scalar);
+        header.intervalSize = sizeof(interval);
+        header.nodeCount = nodes.size();
+        header.intervalCount = intervalCount;
+        header.root = nodes.empty() ? indexNone : 0;
+        header.nodesOffset = indexAlign(sizeof(IndexHeader));
+        header.intervalsOffset = indexAlign(header.nodesOffset
+                                            + nodes.size() * sizeof(node_type));
+
+        std::uint64_t offset = 0;
+        writeBytes(os, offset, &header, sizeof(header));
+        pad(os, offset, header.nodesOffset);
+        writeBytes(os, offset, nodes.data(), nodes.size() * sizeof(node_type));
+        pad(os, offset, header.intervalsOffset);
+        for (const tree_type* t : order) {
+            writeBytes(os, offset, t->intervals.data(),
+                       t->intervals.size() * sizeof(interval));
+        }
+        if (!os) {
+            throw std::runtime_error("failed to write interval tree index");
+        }
+    }
+
+private:
+    static void preorder(const tree_type* t, std::vector<const tree_type*>& order) {
+        t->visit_nodes([&](const tree_type& node) { order.push_back(&node); });
+    }
+
+    static void breadthFirst(const tree_type* t, std::vector<const tree_type*>& order) {
+        order.push_back(t);
+        for (std::size_t n = 0; n != order.size(); ++n) {
+            if (order[n]->left) {
+                order.push_back(order[n]->left.get());
+            }
+            if (order[n]->right) {
+                order.push_back(order[n]->right.get());
+            }
+        }
+    }
+
+    static std::size_t height(const tree_type* t) {
+        return 1 + std::max(t->left ? height(t->left.get()) : 0,
+                            t->right ? height(t->right.get()) : 0);
+    }
+
+    // Append the nodes of the top levels of the subtree at t: the top half
+    // of those levels first, then each subtree hanging below it, left to
+    // right.
+    static void vanEmdeBoas(const tree_type* t, std::size_t levels,
+                            std::vector<const tree_type*>& order) {
+        if (levels == 1) {
+            order.push_back(t);
+            return;
+        }
+        const std::size_t top = levels / 2;
+        vanEmdeBoas(t, top, order);
+        std::vector<const tree_type*> bottoms;
+        descendants(t, top, bottoms);
+        for (const tree_type* b : bottoms) {
+            vanEmdeBoas(b, levels - top, order);
+        }
+    }
+
+    // The nodes exactly depth levels below t, left to right.
+    static void descendants(const tree_type* t, std::size_t depth,
+                            std::vector<const tree_type*>& out) {
+        if (depth == 0) {
+            out.push_back(t);
+            return;
+        }
+        if (t->left) {
+            descendants(t->left.get(), depth - 1, out);
+        }
+        if (t->right) {
+            descendants(t->right.get(), depth - 1, out);
+        }
+    }
+
+    static void writeBytes(std::ostream& os, std::uint64_t& offset,
+                           const void* data, std::size_t size) {
+        os.write(static_cast<const char*>(data), size);
+        offset += size;
+    }
+
+    static void pad(std::ostream& os, std::uint64_t& offset, std::uint64_t to) {
+        static const char zeros[indexAlignment] = {};
+        os.write(zeros, to - offset);
+        offset = to;
+    }
+};
+
+template <class Scalar, class Value>
+void writeIndex(std::ostream& os, const IntervalTree<Scalar, Value>& tree,
+                IndexLayout layout = VanEmdeBoasLayout) {
+    IntervalTreeIndexBuilder<Scalar, Value>::write(os, tree, layout);
+}
+
+template <class Scalar, class Value>
+void writeIndex(const std::string& path, const IntervalTree<Scalar, Value>& tree,
+                IndexLayout layout = VanEmdeBoasLayout) {
+    std::ofstream os(path.c_str(), std::ios::binary | std::ios::trunc);
+    if (!os) {
+        throw std::runtime_error("cannot open " + path + " for writing");
+    }
+    writeIndex(os, tree, layout);
+}
+
+// The filtering queries shared by the index readers, built on the
+// reader's visit_near.
+template <class Derived, class Scalar, class Value>
+class IndexQueries {
+public:
+    typedef Interval<Scalar, Value> interval;
+    typedef std::vector<interval> interval_vector;
+
+    // Call f on all intervals crossing pos
+    template <class UnaryFunction>
+    void visit_overlapping(const Scalar& pos, UnaryFunction f) const {
+        visit_overlapping(pos, pos, f);
+    }
+
+    // Call f on all intervals overlapping [start, stop]
+    template <class UnaryFunction>
+    void visit_overlapping(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        auto filterF = [&](const interval& interval) {
+            if (interval.stop >= start && interval.start <= stop) {
+                f(interval);
+            }
+        };
+        derived().visit_near(start, stop, filterF);
+    }
+
+    // Call f on all intervals contained within [start, stop]
+    template <class UnaryFunction>
+    void visit_contained(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        auto filterF = [&](const interval& interval) {
+            if (start <= interval.start && interval.stop <= stop) {
+                f(interval);
+            }
+        };
+        derived().visit_near(start, stop, filterF);
+    }
+
+    interval_vector findOverlapping(const Scalar& start, const Scalar& stop) const {
+        interval_vector result;
+        visit_overlapping(start, stop,
+                          [&](const interval& interval) {
+                            result.push_back(interval);
+                          });
+        return result;
+    }
+
+    interval_vector findContained(const Scalar& start, const Scalar& stop) const {
+        interval_vector result;
+        visit_contained(start, stop,
+                        [&](const interval& interval) {
+                          result.push_back(interval);
+                        });
+        return result;
+    }
+
+private:
+    const Derived& derived() const { return static_cast<const Derived&>(*this); }
+};
+
+// Read-only view of an index held in memory. Queries run directly against
+// the buffer, and the intervals passed to callbacks point into it.
+template <class Scalar, class Value>
+class IntervalTreeIndexView
+    : public IndexQueries<IntervalTreeIndexView<Scalar, Value>, Scalar, Value> {
+public:
+    typedef Interval<Scalar, Value> interval;
+    typedef std::vector<interval> interval_vector;
+    typedef IndexNode<Scalar> node_type;
+
+    static_assert(std::is_trivially_copyable<interval>::value,
+                  "an interval tree index requires trivially copyable intervals");
+
+    IntervalTreeIndexView()
+        : nodes(nullptr)
+        , intervals(nullptr)
+        , nodeCount(0)
+        , intervalCount(0)
+        , root(indexNone)
+    {}
+
+    IntervalTreeIndexView(const void* data, std::size_t size)
+        : IntervalTreeIndexView()
+    {
+        if (!data || size < sizeof(IndexHeader)) {
+            throw std::runtime_error("interval tree index is truncated");
+        }
+        IndexHeader header;
+        std::memcpy(&header, data, sizeof(header));
+        checkIndexHeader<Scalar, interval>(header, size);
+        const char* base = static_cast<const char*>(data);
+        if (reinterpret_cast<std::uintptr_t>(base) % indexAlignment != 0) {
+            throw std::runtime_error("interval tree index buffer is misaligned");
+        }
+        nodes = reinterpret_cast<const node_type*>(base + header.nodesOffset);
+        intervals = reinterpret_cast<const interval*>(base + header.intervalsOffset);
+        nodeCount = header.nodeCount;
+        intervalCount = header.intervalCount;
+        root = header.root;
+    }
+
+    // Opening only checks the header. Throw if any node refers outside the
+    // index, or the nodes do not form a tree; this reads every node.
+    void verify() const {
+        checkIndexNodes(nodes, nodeCount, root, intervalCount);
+    }
+
+    // Call f on all intervals near the range [start, stop]:
+    template <class UnaryFunction>
+    void visit_near(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        if (root != indexNone) {
+            visit_near(root, start, stop, f);
+        }
+    }
+
+    template <class UnaryFunction>
+    void visit_all(UnaryFunction f) const {
+        if (root != indexNone) {
+            visit_all(root, f);
+        }
+    }
+
+    bool empty() const {
+        for (std::uint64_t n = 0; n != nodeCount; ++n) {
+            if (nodes[n].begin != nodes[n].end) {
+                return false;
+            }
+        }
+        return true;
+    }
+
+private:
+    template <class UnaryFunction>
+    void visit_near(std::uint64_t n, const Scalar& start, const Scalar& stop,
+                    UnaryFunction& f) const {
+        const node_type& node = nodes[n];
+        if (node.begin != node.end && ! (stop < node.first)) {
+            for (std::uint64_t i = node.begin; i != node.end; ++i) {
+                f(intervals[i]);
+            }
+        }
+        if (node.left != indexNone && start <= node.center) {
+            visit_near(node.left, start, stop, f);
+        }
+        if (node.right != indexNone && stop >= node.center) {
+            visit_near(node.right, start, stop, f);
+        }
+    }
+
+    template <class UnaryFunction>
+    void visit_all(std::uint64_t n, UnaryFunction& f) const {
+        const node_type& node = nodes[n];
+        if (node.left != indexNone) {
+            visit_all(node.left, f);
+        }
+        for (std::uint64_t i = node.begin; i != node.end; ++i) {
+            f(intervals[i]);
+        }
+        if (node.right != indexNone) {
+            visit_all(node.right, f);
+        }
+    }
+
+    const node_type* nodes;
+    const interval* intervals;
+    std::uint64_t nodeCount;
+    std::uint64_t intervalCount;
+    std::uint64_t root;
+};
+
+// An index file mapped read-only into memory. Processes mapping the same
+// file share its page-cached copy, and opening it only validates the header.
+template <class Scalar, class Value>
+class MappedIntervalTree : public IntervalTreeIndexView<Scalar, Value> {
+public:
+    typedef IntervalTreeIndexView<Scalar, Value> view_type;
+
+    MappedIntervalTree() {}
+
+    explicit MappedIntervalTree(const std::string& path)
+        : file(path)
+    {
+        view_type::operator=(view_type(file.data(), file.size()));
+    }
+
+    MappedIntervalTree(MappedIntervalTree&& other)
+        : view_type(other)
+        , file(std::move(other.file))
+    {
+        static_cast<view_type&>(other) = view_type();
+    }
+
+    MappedIntervalTree& operator=(MappedIntervalTree&& other) {
+        if (this != &other) {
+            view_type::operator=(other);
+            file = std::move(other.file);
+            static_cast<view_type&>(other) = view_type();
+        }
+        return *this;
+    }
+
+private:
+    MappedFile file;
+};
+
+// An index file too large to map as a whole. Only a prefix of the node
+// array of at most residentBytes is read into memory when the file is
+// opened; with the van Emde Boas and breadth-first layouts this holds the
+// top levels of the tree, which every query walks. The other nodes, in
+// blocks of about a page, and the node buckets are read on demand and share
+// a least-recently-used cache of at most cacheBytes. Resident memory is
+// thus bounded by residentBytes + cacheBytes whatever the index size,
+// besides the buckets and blocks in use by running queries. Resident nodes
+// are checked when opening, the others as they are read. The intervals
+// passed to callbacks are only valid during the call.
+template <class Scalar, class Value>
+class PagedIntervalTree
+    : public IndexQueries<PagedIntervalTree<Scalar, Value>, Scalar, Value> {
+public:
+    typedef Interval<Scalar, Value> interval;
+    typedef std::vector<interval> interval_vector;
+    typedef IndexNode<Scalar> node_type;
+
+    static_assert(std::is_trivially_copyable<interval>::value,
+                  "an interval tree index requires trivially copyable intervals");
+
+    PagedIntervalTree()
+        : nodeCount(0)
+        , intervalCount(0)
+        , root(indexNone)
+    {}
+
+    explicit PagedIntervalTree(const std::string& path,
+                               std::size_t cacheBytes = std::size_t(64) << 20,
+                               std::size_t residentBytes = std::size_t(1) << 20)
+        : nodeCount(0)
+        , intervalCount(0)
+        , root(indexNone)
+        , cache(new Cache(cacheBytes))
+    {
+        cache->fd = ::open(path.c_str(), O_RDONLY);
+        if (cache->fd < 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        struct stat st;
+        if (::fstat(cache->fd, &st) != 0) {
+            throw std::runtime_error("cannot stat " + path);
+        }
+        IndexHeader header;
+        if (st.st_size < off_t(sizeof(header))) {
+            throw std::runtime_error("interval tree index is truncated");
+        }
+        read(&header, sizeof(header), 0);
+        checkIndexHeader<Scalar, interval>(header, st.st_size);
+        nodeCount = header.nodeCount;
+        intervalCount = header.intervalCount;
+        nodesOffset = header.nodesOffset;
+        intervalsOffset = header.intervalsOffset;
+        // every layout stores the root first
+        if (header.root != indexNone && header.root != 0) {
+            throw std::runtime_error("interval tree index is corrupt");
+        }
+        resident.resize(std::min<std::uint64_t>(nodeCount, residentBytes / sizeof(node_type)));
+        read(resident.data(), resident.size() * sizeof(node_type), nodesOffset);
+        for (std::size_t n = 0; n != resident.size(); ++n) {
+            checkIndexNode(resident[n], n, nodeCount, intervalCount);
+        }
+        root = header.root;
+    }
+
+    // Call f on all intervals near the range [start, stop]:
+    template <class UnaryFunction>
+    void visit_near(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        if (root != indexNone) {
+            visit_near(root, start, stop, f);
+        }
+    }
+
+    template <class UnaryFunction>
+    void visit_all(UnaryFunction f) const {
+        if (root != indexNone) {
+            visit_all(root, f);
+        }
+    }
+
+    bool empty() const { return intervalCount == 0; }
+
+    // Bytes of nodes held in memory for the life of the tree.
+    std::size_t residentBytes() const {
+        return resident.capacity() * sizeof(node_type);
+    }
+
+    // Bytes of node blocks and node buckets currently held in the cache.
+    std::size_t cachedBytes() const {
+        if (!cache) {
+            return 0;
+        }
+        std::lock_guard<std::mutex> lock(cache->mutex);
+        return cache->bytes;
+    }
+
+private:
+    static const std::size_t blockNodes = 4096 / sizeof(node_type) ? 4096 / sizeof(node_type) : 1;
+    static const std::size_t pageAlignment =
+        alignof(interval) < alignof(node_type) ? alignof(node_type) : alignof(interval);
+
+    typedef typename std::aligned_storage<pageAlignment, pageAlignment>::type word;
+
+    // A node bucket or a block of nodes read from the file.
+    struct Page {
+        std::unique_ptr<word[]> storage;
+        std::size_t bytes;
+
+        template <class T>
+        const T* as() const { return reinterpret_cast<const T*>(storage.get()); }
+    };
+
+    typedef std::shared_ptr<const Page> page_ptr;
+
+    struct Cache {
+        explicit Cache(std::size_t capacity)
+            : fd(-1)
+            , capacity(capacity)
+            , bytes(0)
+        {}
+
+        ~Cache() {
+            if (fd >= 0) {
+                ::close(fd);
+            }
+        }
+
+        int fd;
+        std::size_t capacity;
+        std::size_t bytes;
+        std::mutex mutex;
+        // most recently used first; keys are 2n for the bucket of node n
+        // and 2b + 1 for node block b
+        std::list<std::uint64_t> recency;
+        std::unordered_map<std::uint64_t,
+                           std::pair<page_ptr, std::list<std::uint64_t>::iterator> > pages;
+    };
+
+    void read(void* into, std::size_t size, std::uint64_t offset) const {
+        char* p = static_cast<char*>(into);
+        while (size != 0) {
+            const ssize_t got = ::pread(cache->fd, p, size, offset);
+            if (got <= 0) {
+                throw std::runtime_error("failed to read interval tree index");
+            }
+            p += got;
+            size -= got;
+            offset += got;
+        }
+    }
+
+    // The page with the given key holding size bytes at offset in the file,
+    // from the cache or read into it.
+    page_ptr fetch(std::uint64_t key, std::size_t size, std::uint64_t offset,
+                   std::uint64_t firstNode = 0) const {
+        {
+            std::lock_guard<std::mutex> lock(cache->mutex);
+            auto hit = cache->pages.find(key);
+            if (hit != cache->pages.end()) {
+                cache->recency.splice(cache->recency.begin(), cache->recency, hit->second.second);
+                return hit->second.first;
+            }
+        }
+
+        std::shared_ptr<Page> page(new Page());
+        page->bytes = size;
+        page->storage.reset(new word[(size + sizeof(word) - 1) / sizeof(word)]);
+        read(page->storage.get(), size, offset);
+        if (key % 2 == 1) {
+            const node_type* nodes = page->template as<node_type>();
+            for (std::size_t k = 0; k != size / sizeof(node_type); ++k) {
+                checkIndexNode(nodes[k], firstNode + k, nodeCount, intervalCount);
+            }
+        }
+
+        std::lock_guard<std::mutex> lock(cache->mutex);
+        auto raced = cache->pages.find(key);
+        if (raced != cache->pages.end()) {
+            return raced->second.first;
+        }
+        cache->recency.push_front(key);
+        cache->pages[key] = std::make_pair(page_ptr(page), cache->recency.begin());
+        cache->bytes += page->bytes;
+        // pages still in use by a query stay alive through their shared_ptr
+        while (cache->bytes > cache->capacity && cache->recency.size() > 1) {
+            auto evicted = cache->pages.find(cache->recency.back());
+            cache->bytes -= evicted->second.first->bytes;
+            cache->pages.erase(evicted);
+            cache->recency.pop_back();
+        }
+        return page;
+    }
+
+    node_type node(std::uint64_t n) const {
+        if (n < resident.size()) {
+            return resident[n];
+        }
+        const std::uint64_t block = n / blockNodes;
+        const std::uint64_t first = block * blockNodes;
+        const std::uint64_t count = std::min(std::uint64_t(blockNodes), nodeCount - first);
+        const page_ptr page = fetch(2 * block + 1, count * sizeof(node_type),
+                                    nodesOffset + first * sizeof(node_type), first);
+        return page->template as<node_type>()[n - first];
+    }
+
+    template <class UnaryFunction>
+    void scan(std::uint64_t n, const node_type& node, UnaryFunction& f) const {
+        const std::size_t count = node.end - node.begin;
+        const page_ptr bucket = fetch(2 * n, count * sizeof(interval),
+                                      intervalsOffset + node.begin * sizeof(interval));
+        const interval* intervals = bucket->template as<interval>();
+        for (std::size_t k = 0; k != count; ++k) {
+            f(intervals[k]);
+        }
+    }
+
+    template <class UnaryFunction>
+    void visit_near(std::uint64_t n, const Scalar& start, const Scalar& stop,
+                    UnaryFunction& f) const {
+        const node_type node = this->node(n);
+        if (node.begin != node.end && ! (stop < node.first)) {
+            scan(n, node, f);
+        }
+        if (node.left != indexNone && start <= node.center) {
+            visit_near(node.left, start, stop, f);
+        }
+        if (node.right != indexNone && stop >= node.center) {
+            visit_near(node.right, start, stop, f);
+        }
+    }
+
+    template <class UnaryFunction>
+    void visit_all(std::uint64_t n, UnaryFunction& f) const {
+        const node_type node = this->node(n);
+        if (node.left != indexNone) {
+            visit_all(node.left, f);
+        }
+        if (node.begin != node.end) {
+            scan(n, node, f);
+        }
+        if (node.right != indexNone) {
+            visit_all(node.right, f);
+        }
+    }
+
+    std::vector<node_type> resident;
+    std::uint64_t nodeCount;
+    std::uint64_t intervalCount;
+    std::uint64_t nodesOffset;
+    std::uint64_t intervalsOffset;
+    std::uint64_t root;
+    std::unique_ptr<Cache> cache;
+};
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+}
+#endif
+
+#endif
@@ -0,0 +1,103 @@
+#ifndef __MAPPED_FILE_H
+#define __MAPPED_FILE_H
+
+#include <cstddef>
+#include <stdexcept>
+#include <string>
+
+#include <fcntl.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+namespace interval_tree {
+#endif
+
+// A whole file mapped read-only into memory.
+class MappedFile {
+public:
+    MappedFile()
+        : bytes(nullptr)
+        , length(0)
+    {}
+
+    explicit MappedFile(const std::string& path)
+        : bytes(nullptr)
+        , length(0)
+    {
+        int fd = ::open(path.c_str(), O_RDONLY);
+        if (fd < 0) {
+            throw std::runtime_error("cannot open " + path);
+        }
+        struct stat st;
+        if (::fstat(fd, &st) != 0) {
+            ::close(fd);
+            throw std::runtime_error("cannot stat " + path);
+        }
+        length = st.st_size;
+        if (length != 0) {
+            void* p = ::mmap(nullptr, length, PROT_READ, MAP_SHARED, fd, 0);
+            if (p == MAP_FAILED) {
+                ::close(fd);
+                throw std::runtime_error("cannot map " + path);
+            }
+            bytes = static_cast<const char*>(p);
+        }
+        ::close(fd);
+    }
+
+    MappedFile(const MappedFile&) = delete;
+    MappedFile& operator=(const MappedFile&) = delete;
+
+    MappedFile(MappedFile&& other)
+        : bytes(other.bytes)
+        , length(other.length)
+    {
+        other.bytes = nullptr;
+        other.length = 0;
+    }
+
+    MappedFile& operator=(MappedFile&& other) {
+        if (this != &other) {
+            unmap();
+            bytes = other.bytes;
+            length = other.length;
+            other.bytes = nullptr;
+            other.length = 0;
+        }
+        return *this;
+    }
+
+    ~MappedFile() {
+        unmap();
+    }
+
+    const char* data() const { return bytes; }
+    std::size_t size() const { return length; }
+
+    // Tell the kernel the mapping will be read front to back.
+    void adviseSequential() const {
+        if (bytes) {
+            ::madvise(const_cast<char*>(bytes), length, MADV_SEQUENTIAL);
+        }
+    }
+
+private:
+    void unmap() {
+        if (bytes) {
+            ::munmap(const_cast<char*>(bytes), length);
+            bytes = nullptr;
+            length = 0;
+        }
+    }
+
+    const char* bytes;
+    std::size_t length;
+};
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+}
+#endif
+
+#endif
@@ -0,0 +1,247 @@
+#ifndef __PERSISTENT_INTERVAL_TREE_H
+#define __PERSISTENT_INTERVAL_TREE_H
+
+#include <algorithm>
+#include <memory>
+#include <utility>
+#include <vector>
+
+#include "IntervalTree.h"
+#include "IntervalTreeIndex.h"
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+namespace interval_tree {
+#endif
+
+// An immutable interval tree whose updates return a new version. Nodes
+// and buckets are shared between versions: insert and erase copy only the
+// nodes on the path to the affected bucket and that bucket, so a version
+// costs O(depth + bucket size) memory rather than a full clone. Copying a
+// tree is O(1) and gives a snapshot that later updates never change, so a
+// reader can keep querying a copy while a writer derives new versions.
+// Passing versions between threads still needs a mutex or an atomic
+// shared_ptr around the variable holding the current one.
+//
+// Leaves collect inserted intervals until they hold maxbucket of them and
+// are then split, as the IntervalTree constructor would split them.
+template <class Scalar, class Value>
+class PersistentIntervalTree
+    : public IndexQueries<PersistentIntervalTree<Scalar, Value>, Scalar, Value> {
+public:
+    typedef Interval<Scalar, Value> interval;
+    typedef std::vector<interval> interval_vector;
+
+    PersistentIntervalTree()
+        : count(0)
+        , depth(16)
+        , minbucket(64)
+        , maxbucket(512)
+    {}
+
+    explicit PersistentIntervalTree(interval_vector&& ivals,
+                                    std::size_t depth = 16,
+                                    std::size_t minbucket = 64,
+                                    std::size_t maxbucket = 512)
+        : count(ivals.size())
+        , depth(depth)
+        , minbucket(minbucket)
+        , maxbucket(maxbucket)
+    {
+        std::sort(ivals.begin(), ivals.end(), StartCmp());
+        root = build(std::move(ivals), depth);
+    }
+
+    // A new version that also holds i.
+    PersistentIntervalTree insert(const interval& i) const {
+        PersistentIntervalTree result(*this);
+        result.root = insert(root, i, depth);
+        ++result.count;
+        return result;
+    }
+
+    // A new version without one interval equal to i (same start, stop and
+    // value), or the same version when there is none.
+    PersistentIntervalTree erase(const interval& i) const {
+        PersistentIntervalTree result(*this);
+        bool erased = false;
+        result.root = erase(root, i, erased);
+        if (erased) {
+            --result.count;
+        }
+        return result;
+    }
+
+    // Call f on all intervals near the range [start, stop]:
+    template <class UnaryFunction>
+    void visit_near(const Scalar& start, const Scalar& stop, UnaryFunction f) const {
+        visit_near(root.get(), start, stop, f);
+    }
+
+    template <class UnaryFunction>
+    void visit_all(UnaryFunction f) const {
+        visit_all(root.get(), f);
+    }
+
+    bool empty() const { return count == 0; }
+    std::size_t size() const { return count; }
+
+private:
+    struct StartCmp {
+        bool operator()(const interval& a, const interval& b) const {
+            return a.start < b.start;
+        }
+    };
+
+    struct Node;
+    typedef std::shared_ptr<const Node> node_ptr;
+    typedef std::shared_ptr<const interval_vector> bucket_ptr;
+
+    struct Node {
+        bucket_ptr intervals;       // sorted by start; null when empty
+        node_ptr left;
+        node_ptr right;
+        Scalar center;
+
+        bool leaf() const { return !left && !right; }
+    };
+
+    // Build a subtree from start-sorted intervals the way the IntervalTree
+    // constructor does.
+    node_ptr build(interval_vector&& ivals, std::size_t levels) const {
+        if (ivals.empty()) {
+            return node_ptr();
+        }
+        std::shared_ptr<Node> node(new Node());
+        Scalar maxStop = ivals.front().stop;
+        for (const interval& i : ivals) {
+            maxStop = std::max(maxStop, i.stop);
+        }
+        node->center = intervalMidpoint(ivals.front().start, maxStop);
+        if (levels <= 1 || ivals.size() < minbucket) {
+            node->intervals = bucket(std::move(ivals));
+            return node;
+        }
+        interval_vector lefts, rights, centers;
+        for (interval& i : ivals) {
+            if (i.stop < node->center) {
+                lefts.push_back(std::move(i));
+            } else if (i.start > node->center) {
+                rights.push_back(std::move(i));
+            } else {
+                centers.push_back(std::move(i));
+            }
+        }
+        node->intervals = bucket(std::move(centers));
+        node->left = build(std::move(lefts), levels - 1);
+        node->right = build(std::move(rights), levels - 1);
+        return node;
+    }
+
+    static bucket_ptr bucket(interval_vector&& ivals) {
+        return ivals.empty() ? bucket_ptr()
+                             : bucket_ptr(new interval_vector(std::move(ivals)));
+    }
+
+    node_ptr insert(const node_ptr& node, const interval& i, std::size_t levels) const {
+        if (!node) {
+            return build(interval_vector(1, i), levels);
+        }
+        std::shared_ptr<Node> copy(new Node(*node));
+        if (!node->leaf() && i.stop < node->center) {
+            copy->left = insert(node->left, i, levels - 1);
+        } else if (!node->leaf() && i.start > node->center) {
+            copy->right = insert(node->right, i, levels - 1);
+        } else {
+            interval_vector ivals;
+            if (node->intervals) {
+                ivals.reserve(node->intervals->size() + 1);
+                ivals.insert(ivals.end(), node->intervals->begin(), node->intervals->end());
+            }
+            ivals.insert(std::upper_bound(ivals.begin(), ivals.end(), i, StartCmp()), i);
+            if (node->leaf() && ivals.size() >= maxbucket) {
+                return build(std::move(ivals), levels);
+            }
+            copy->intervals = bucket(std::move(ivals));
+        }
+        return copy;
+    }
+
+    static node_ptr erase(const node_ptr& node, const interval& i, bool& erased) {
+        if (!node) {
+            return node;
+        }
+        std::shared_ptr<Node> copy(new Node(*node));
+        if (!node->leaf() && i.stop < node->center) {
+            copy->left = erase(node->left, i, erased);
+        } else if (!node->leaf() && i.start > node->center) {
+            copy->right = erase(node->right, i, erased);
+        } else if (node->intervals) {
+            const interval_vector& ivals = *node->intervals;
+            auto found = std::lower_bound(ivals.begin(), ivals.end(), i, StartCmp());
+            while (found != ivals.end() && found->start == i.start
+                   && !(found->stop == i.stop && found->value == i.value)) {
+                ++found;
+            }
+            if (found != ivals.end() && found->start == i.start) {
+                interval_vector rest;
+                rest.reserve(ivals.size() - 1);
+                rest.insert(rest.end(), ivals.begin(), found);
+                rest.insert(rest.end(), found + 1, ivals.end());
+                copy->intervals = bucket(std::move(rest));
+                erased = true;
+            }
+        }
+        if (!erased) {
+            return node;
+        }
+        if (!copy->intervals && copy->leaf()) {
+            return node_ptr();
+        }
+        return copy;
+    }
+
+    template <class UnaryFunction>
+    static void visit_near(const Node* node, const Scalar& start, const Scalar& stop,
+                           UnaryFunction& f) {
+        if (!node) {
+            return;
+        }
+        if (node->intervals && ! (stop < node->intervals->front().start)) {
+            for (const interval& i : *node->intervals) {
+                f(i);
+            }
+        }
+        if (node->left && start <= node->center) {
+            visit_near(node->left.get(), start, stop, f);
+        }
+        if (node->right && stop >= node->center) {
+            visit_near(node->right.get(), start, stop, f);
+        }
+    }
+
+    template <class UnaryFunction>
+    static void visit_all(const Node* node, UnaryFunction& f) {
+        if (!node) {
+            return;
+        }
+        visit_all(node->left.get(), f);
+        if (node->intervals) {
+            for (const interval& i : *node->intervals) {
+                f(i);
+            }
+        }
+        visit_all(node->right.get(), f);
+    }
+
+    node_ptr root;
+    std::size_t count;
+    std::size_t depth;
+    std::size_t minbucket;
+    std::size_t maxbucket;
+};
+
+#ifdef USE_INTERVAL_TREE_NAMESPACE
+}
+#endif
+
+#endif
@@ -0,0 +1,432 @@
+#include <algorithm>
+#include <chrono>
+#include <cerrno>
+#include <cstdlib>
+#include <cstring>
+#include <fstream>
+#include <iostream>
+#include <map>
+#include <sstream>
+#include <string>
+#include <vector>
+#include <sys/resource.h>
+#include <sys/wait.h>
+#include <unistd.h>
+#include "IntervalTree.h"
+#include "interval_tree_workloads.h"
+
+using namespace std;
+
+// Build and query benchmarks over fixed-seed workloads. Results are written
+// as tab-separated lines, one per workload and size, with a header line.
+// The same table can be saved as a baseline and later runs compared
+// against it, failing when build time, query time or tree size regress.
+// Times are the median of several runs, and runs too short to time
+// reliably are not compared.
+// Each workload and size runs in its own child process, so max_rss_kb is
+// the peak memory of that run alone.
+
+typedef chrono::steady_clock Clock;
+
+struct Options {
+    vector<size_t> sizes;
+    vector<string> workloads;
+    size_t queries;
+    size_t repeat;
+    size_t group;
+    unsigned long seed;
+    string save;
+    string compare;
+    double threshold;
+    double minTimeMs;
+
+    Options()
+        : sizes({ 1000, 10000, 100000, 1000000 })
+        , queries(100000)
+        , repeat(5)
+        , group(0)
+        , seed(42)
+        , threshold(0.10)
+        , minTimeMs(1)
+    {}
+};
+
+const char* const columns[] = {
+    "workload", "size", "seed", "build_ms", "queries", "query_ns", "queries_per_s", "hits",
+    "tree_bytes", "nodes", "depth", "center_spanning", "max_rss_kb"
+};
+
+const size_t columnCount = sizeof(columns) / sizeof(columns[0]);
+
+// One output line, by column name.
+typedef map<string, string> Row;
+
+// Rows from runs with the same input are compared with each other.
+string rowKey(const Row& row) {
+    return row.at("workload") + '\t' + row.at("size") + '\t' + row.at("seed")
+        + '\t' + row.at("queries");
+}
+
+void writeHeader(ostream& os) {
+    for (size_t c = 0; c != columnCount; ++c) {
+        os << (c ? "\t" : "") << columns[c];
+    }
+    os << '\n';
+}
+
+void writeRow(ostream& os, const Row& row) {
+    for (size_t c = 0; c != columnCount; ++c) {
+        os << (c ? "\t" : "") << row.at(columns[c]);
+    }
+    os << '\n';
+}
+
+// Parse a line written by writeRow.
+Row parseRow(const string& line) {
+    Row row;
+    stringstream ls(line);
+    string value;
+    for (size_t c = 0; c != columnCount && getline(ls, value, '\t'); ++c) {
+        row[columns[c]] = value;
+    }
+    return row;
+}
+
+bool readRows(const string& path, vector<Row>& rows) {
+    ifstream in(path.c_str());
+    string line;
+    if (!in || !getline(in, line)) {
+        return false;
+    }
+    vector<string> header;
+    stringstream hs(line);
+    for (string name; getline(hs, name, '\t'); ) {
+        header.push_back(name);
+    }
+    while (getline(in, line)) {
+        Row row;
+        stringstream ls(line);
+        string value;
+        for (size_t c = 0; c != header.size() && getline(ls, value, '\t'); ++c) {
+            row[header[c]] = value;
+        }
+        for (const char* column : columns) {
+            if (!row.count(column)) {
+                return false;
+            }
+        }
+        rows.push_back(row);
+    }
+    return true;
+}
+
+// Report every row of current that got worse than its baseline row by more
+// than threshold; returns the number of regressions. Build and query times
+// whose baseline total is under minTimeMs are mostly timer and scheduling
+// noise and are skipped.
+size_t compareRows(const vector<Row>& baseline, const vector<Row>& current, double threshold,
+                   double minTimeMs) {
+    map<string, const Row*> byKey;
+    for (const Row& row : baseline) {
+        byKey[rowKey(row)] = &row;
+    }
+    // metrics where larger is worse
+    const char* const metrics[] = { "build_ms", "query_ns", "tree_bytes" };
+    size_t regressions = 0;
+    for (const Row& row : current) {
+        auto base = byKey.find(rowKey(row));
+        if (base == byKey.end()) {
+            cerr << "no baseline for " << row.at("workload") << ' ' << row.at("size") << '\n';
+            continue;
+        }
+        if (base->second->at("hits") != row.at("hits")) {
+            cerr << "RESULTS CHANGED " << row.at("workload") << ' ' << row.at("size")
+                 << " hits " << base->second->at("hits") << " -> " << row.at("hits") << '\n';
+            ++regressions;
+        }
+        const double queries = strtod(base->second->at("queries").c_str(), nullptr);
+        for (const char* metric : metrics) {
+            const double before = strtod(base->second->at(metric).c_str(), nullptr);
+            const double after = strtod(row.at(metric).c_str(), nullptr);
+            const string name = metric;
+            if ((name == "build_ms" && before < minTimeMs)
+                || (name == "query_ns" && before * queries / 1e6 < minTimeMs)) {
+                continue;
+            }
+            const double change = before > 0 ? after / before - 1 : 0;
+            if (change > threshold) {
+                cerr << "REGRESSION " << row.at("workload") << ' ' << row.at("size")
+                     << ' ' << metric << ' ' << before << " -> " << after
+                     << " (+" << change * 100 << "%)\n";
+                ++regressions;
+            }
+        }
+    }
+    return regressions;
+}
+
+void usage(const char* argv0) {
+    cerr << "usage: " << argv0 << " [options]\n"
+         << "  --sizes N,N,...      interval counts (default 1000,10000,100000,1000000)\n"
+         << "  --workloads W,W,...  any of:";
+    for (const Workload& w : benchWorkloads) {
+        cerr << ' ' << w.name;
+    }
+    cerr << " (default all)\n"
+         << "  --queries N          queries per run (default 100000)\n"
+         << "  --repeat N           runs per measurement, the median is reported (default 5,\n"
+         << "                       at least 3 with --compare)\n"
+         << "  --group N            interleave N queries with visit_overlapping_batch\n"
+         << "                       (default 0: one query at a time)\n"
+         << "  --seed N             base random seed (default 42)\n"
+         << "  --save FILE          also write the results to FILE\n"
+         << "  --compare FILE       fail if results regress against those saved in FILE\n"
+         << "  --threshold F        allowed relative regression (default 0.10)\n"
+         << "  --min-time MS        do not compare times whose baseline is under MS\n"
+         << "                       milliseconds (default 1)\n";
+}
+
+vector<string> splitList(const string& list) {
+    vector<string> items;
+    stringstream ss(list);
+    string item;
+    while (getline(ss, item, ',')) {
+        if (!item.empty()) {
+            items.push_back(item);
+        }
+    }
+    return items;
+}
+
+bool parseOptions(int argc, char** argv, Options& options) {
+    for (int i = 1; i < argc; ++i) {
+        const string arg = argv[i];
+        if (i + 1 == argc) {
+            return false;
+        }
+        const string value = argv[++i];
+        if (arg == "--sizes") {
+            options.sizes.clear();
+            for (const string& s : splitList(value)) {
+                options.sizes.push_back(strtoull(s.c_str(), nullptr, 10));
+            }
+        } else if (arg == "--workloads") {
+            options.workloads = splitList(value);
+        } else if (arg == "--queries") {
+            options.queries = strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--repeat") {
+            options.repeat = max<size_t>(1, strtoull(value.c_str(), nullptr, 10));
+        } else if (arg == "--group") {
+            options.group = strtoull(value.c_str(), nullptr, 10);
+        } else if (arg == "--seed") {
+            options.seed = strtoul(value.c_str(), nullptr, 10);
+        } else if (arg == "--save") {
+            options.save = value;
+        } else if (arg == "--compare") {
+            options.compare = value;
+        } else if (arg == "--threshold") {
+            options.threshold = strtod(value.c_str(), nullptr);
+        } else if (arg == "--min-time") {
+            options.minTimeMs = strtod(value.c_str(), nullptr);
+        } else {
+            return false;
+        }
+    }
+    if (!options.compare.empty()) {
+        options.repeat = max<size_t>(options.repeat, 3);
+    }
+    return true;
+}
+
+double seconds(Clock::duration d) {
+    return chrono::duration_cast<chrono::duration<double> >(d).count();
+}
+
+Clock::duration median(vector<Clock::duration> times) {
+    nth_element(times.begin(), times.begin() + times.size() / 2, times.end());
+    return times[times.size() / 2];
+}
+
+// Generate, build and query one workload at one size.
+Row runBenchmark(const Workload& workload, size_t w, size_t size, const Options& options) {
+    // the same seed for a workload and size always gives the same input
+    const unsigned long seed = options.seed * 1000003 + size * 31 + w;
+    BenchRng rng(seed);
+    BenchIntervals intervals;
+    intervals.reserve(size);
+    workload.generate(size, rng, intervals);
+    BenchIntervals queries;
+    queries.reserve(options.queries);
+    queryWindows(options.queries, intervals, rng, queries);
+
+    vector<Clock::duration> builds;
+    BenchTree tree;
+    for (size_t r = 0; r != options.repeat; ++r) {
+        BenchIntervals copy = intervals;
+        const Clock::time_point t0 = Clock::now();
+        BenchTree built(std::move(copy));
+        builds.push_back(Clock::now() - t0);
+        tree = std::move(built);
+    }
+    intervals = BenchIntervals();
+
+    vector<Clock::duration> runs;
+    size_t hits = 0;
+    for (size_t r = 0; r != options.repeat; ++r) {
+        hits = 0;
+        const Clock::time_point t0 = Clock::now();
+        if (options.group != 0) {
+            tree.visit_overlapping_batch(queries,
+                                         [&](size_t, const BenchInterval&) { ++hits; },
+                                         options.group);
+        } else {
+            for (const BenchInterval& q : queries) {
+                tree.visit_overlapping(q.start, q.stop,
+                                       [&](const BenchInterval&) { ++hits; });
+            }
+        }
+        runs.push_back(Clock::now() - t0);
+    }
+    const Clock::duration build = median(builds);
+    const Clock::duration query = median(runs);
+
+    const BenchTree::Stats stats = tree.stats();
+    const double querySeconds = seconds(query);
+    Row row;
+    auto set = [&](const char* column, double value) {
+        ostringstream os;
+        os << value;
+        row[column] = os.str();
+    };
+    row["workload"] = workload.name;
+    row["size"] = to_string(size);
+    row["seed"] = to_string(seed);
+    set("build_ms", seconds(build) * 1e3);
+    row["queries"] = to_string(queries.size());
+    set("query_ns", queries.empty() ? 0 : querySeconds * 1e9 / queries.size());
+    set("queries_per_s", querySeconds > 0 ? queries.size() / querySeconds : 0);
+    row["hits"] = to_string(hits);
+    row["tree_bytes"] = to_string(stats.bytes);
+    row["nodes"] = to_string(stats.nodes);
+    row["depth"] = to_string(stats.depth);
+    row["center_spanning"] = to_string(stats.centerSpanning);
+    row["max_rss_kb"] = "0";
+    return row;
+}
+
+// Run one benchmark in a child process, which sends its row back through a
+// pipe, and fill in max_rss_kb from the child's resource usage. Memory of
+// earlier runs is thus not counted. Returns false if the child failed.
+bool runIsolated(const Workload& workload, size_t w, size_t size, const Options& options,
+                 Row& row) {
+    int fds[2];
+    if (pipe(fds) != 0) {
+        return false;
+    }
+    const pid_t pid = fork();
+    if (pid < 0) {
+        close(fds[0]);
+        close(fds[1]);
+        return false;
+    }
+    if (pid == 0) {
+        close(fds[0]);
+        ostringstream os;
+        writeRow(os, runBenchmark(workload, w, size, options));
+        const string line = os.str();
+        size_t written = 0;
+        while (written != line.size()) {
+            const ssize_t n = write(fds[1], line.data() + written, line.size() - written);
+            if (n <= 0) {
+                _exit(1);
+            }
+            written += n;
+        }
+        _exit(0);
+    }
+    close(fds[1]);
+    string line;
+    char buffer[4096];
+    for (ssize_t n; (n = read(fds[0], buffer, sizeof(buffer))) != 0; ) {
+        if (n > 0) {
+            line.append(buffer, n);
+        } else if (errno != EINTR) {
+            break;
+        }
+    }
+    close(fds[0]);
+    int status = 0;
+    struct rusage usage;
+    if (wait4(pid, &status, 0, &usage) != pid
+        || !WIFEXITED(status) || WEXITSTATUS(status) != 0) {
+        return false;
+    }
+    if (!line.empty() && line[line.size() - 1] == '\n') {
+        line.erase(line.size() - 1);
+    }
+    row = parseRow(line);
+    if (row.size() != columnCount) {
+        return false;
+    }
+    row["max_rss_kb"] = to_string(usage.ru_maxrss);
+    return true;
+}
+
+int main(int argc, char** argv) {
+    Options options;
+    if (!parseOptions(argc, argv, options)) {
+        usage(argv[0]);
+        return 1;
+    }
+
+    vector<Row> baseline;
+    if (!options.compare.empty() && !readRows(options.compare, baseline)) {
+        cerr << "cannot read benchmark results from " << options.compare << endl;
+        return 1;
+    }
+
+    writeHeader(cout);
+    // nothing buffered may be duplicated into the children
+    cout << flush;
+    vector<Row> rows;
+
+    for (size_t w = 0; w != sizeof(benchWorkloads) / sizeof(benchWorkloads[0]); ++w) {
+        const Workload& workload = benchWorkloads[w];
+        if (!options.workloads.empty()
+            && find(options.workloads.begin(), options.workloads.end(), workload.name)
+               == options.workloads.end()) {
+            continue;
+        }
+        for (size_t size : options.sizes) {
+            Row row;
+            if (!runIsolated(workload, w, size, options, row)) {
+                cerr << "benchmark " << workload.name << ' ' << size << " failed" << endl;
+                return 1;
+            }
+            rows.push_back(row);
+            writeRow(cout, row);
+            cout << flush;
+        }
+    }
+
+    if (!options.save.empty()) {
+        ofstream out(options.save.c_str());
+        writeHeader(out);
+        for (const Row& row : rows) {
+            writeRow(out, row);
+        }
+        if (!out) {
+            cerr << "cannot write benchmark results to " << options.save << endl;
+            return 1;
+        }
+    }
+    if (!options.compare.empty()) {
+        const size_t regressions = compareRows(baseline, rows, options.threshold,
+                                               options.minTimeMs);
+        if (regressions != 0) {
+            cerr << regressions << " regression(s) against " << options.compare << endl;
+            return 2;
+        }
+    }
+    return 0;
+}
@@ -1,11 +1,24 @@
 #include <iostream>
 #include <thread>
-#include <chrono>
 #include <random>
 #include <limits>
-#include <time.h>
+#include <tuple>
+#include <fstream>
+#include <cstddef>
+#include <functional>
+#include <atomic>
+#include <cstdlib>
+#include <new>
 #include <assert.h>
+#include <unistd.h>
 #include "IntervalTree.h"
+#include "IntervalTreeIndex.h"
+#include "IntervalFileLoader.h"
+#include "IntervalForest.h"
+#include "CompressedIntervalTree.h"
+#include "IndexedIntervalTree.h"
+#include "PersistentIntervalTree.h"
+#include "AtomicIntervalTree.h"
 #define CATCH_CONFIG_RUNNER // Mark this as file as the test-runner for catch
 #include "catch.hpp"        // Include the catch unit test framework
 
@@ -115,10 +128,1265 @@ Interval<Scalar, Value> randomInterval(Scalar maxStart,  Scalar maxLength, Scala
     return Interval<Scalar, Value>(start, stop, value);
 }
 
-int main(int argc, char**argv) {
-    typedef vector<std::size_t> countsVector;
+struct CopyCounted {
+    static int copies;
+    int id;
+    explicit CopyCounted(int id) : id(id) {}
+    CopyCounted(const CopyCounted& other) : id(other.id) { ++copies; }
+    CopyCounted(CopyCounted&&) = default;
+    CopyCounted& operator=(const CopyCounted& other) { id = other.id; ++copies; return *this; }
+    CopyCounted& operator=(CopyCounted&&) = default;
+};
+
+int CopyCounted::copies = 0;
+
+// Bytes requested from the heap, to check that sweeps stream over the
+// overlapping intervals instead of collecting them.
+static std::atomic<std::size_t> allocatedBytes(0);
+
+void* operator new(std::size_t size) {
+    allocatedBytes += size;
+    if (void* p = std::malloc(size ? size : 1)) {
+        return p;
+    }
+    throw std::bad_alloc();
+}
+
+void* operator new(std::size_t size, const std::nothrow_t&) noexcept {
+    allocatedBytes += size;
+    return std::malloc(size ? size : 1);
+}
+
+void operator delete(void* p) noexcept {
+    std::free(p);
+}
+
+void operator delete(void* p, const std::nothrow_t&) noexcept {
+    std::free(p);
+}
+
+#ifdef __cpp_sized_deallocation
+void operator delete(void* p, std::size_t) noexcept {
+    std::free(p);
+}
+#endif
+
+const long sweepPoints = 100000;
+
+// Run sweep(tree, start, stop) over a tree of sweepPoints single positions
+// 0, 2, 4, ... with a query covering all of them, and check that it
+// allocates well under the size of the intervals: a streaming sweep holds
+// a cursor per bucket, a collecting one holds every interval.
+template <class Sweep>
+bool sweepStreams(Sweep sweep) {
+    typedef IntervalTree<long, int> ITree;
+    ITree::interval_vector points;
+    for (long i = 0; i < sweepPoints; ++i) {
+        points.push_back(ITree::interval(2 * i, 2 * i, int(i)));
+    }
+    const ITree tree(std::move(points));
+    allocatedBytes = 0;
+    sweep(tree, 0L, 2 * sweepPoints);
+    const std::size_t allocated = allocatedBytes;
+    return allocated < sweepPoints * sizeof(ITree::interval) / 4;
+}
+
+TEST_CASE( "Move-only and emplaced values" ) {
+    typedef IntervalTree<int, std::unique_ptr<int> > ITree;
+    std::mt19937 rng(8);
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 2000; ++i) {
+        int start = rng() % 10000;
+        intervals.emplace_back(start, start + rng() % 100, std::unique_ptr<int>(new int(i)));
+    }
+    ITree tree(std::move(intervals), 16, 4, 32);
+    ITree moved(std::move(tree));
+    std::vector<bool> seen(2000);
+    moved.visit_all([&](const ITree::interval& i) { seen[*i.value] = true; });
+    REQUIRE( std::count(seen.begin(), seen.end(), true) == 2000 );
+    std::size_t hits = 0;
+    moved.visit_overlapping(5000, 5100, [&](const ITree::interval& i) {
+        REQUIRE( i.value );
+        ++hits;
+    });
+    REQUIRE( hits > 0 );
+
+    SECTION ("Building does not copy values") {
+        IntervalTree<int, CopyCounted>::interval_vector counted;
+        for (int i = 0; i < 2000; ++i) {
+            int start = rng() % 10000;
+            counted.emplace_back(start, start + rng() % 100, CopyCounted(i));
+        }
+        CopyCounted::copies = 0;
+        IntervalTree<int, CopyCounted> countedTree(std::move(counted), 16, 4, 32);
+        REQUIRE( CopyCounted::copies == 0 );
+    }
+
+    SECTION ("Values constructed in place") {
+        IntervalTree<int, std::pair<int, std::string> >::interval_vector pairs;
+        pairs.emplace_back(3, 1, 7, "seven");
+        REQUIRE( pairs.front().start == 1 );
+        REQUIRE( pairs.front().value.second == "seven" );
+    }
+}
+
+TEST_CASE( "Bulk insertion into a built tree" ) {
+    typedef IntervalTree<int, int> ITree;
+    std::mt19937 rng(19);
+    auto randomIntervals = [&](int count, int first) {
+        ITree::interval_vector result;
+        for (int i = 0; i < count; ++i) {
+            int start = rng() % 100000;
+            result.push_back(ITree::interval(start, start + rng() % 1000, first + i));
+        }
+        return result;
+    };
+    ITree::interval_vector all = randomIntervals(20000, 0);
+    ITree::interval_vector initial = all;
+    ITree tree(std::move(initial), 16, 16, 128);
+    auto check = [&]() {
+        REQUIRE( tree.is_valid().first );
+        for (int q = 0; q < 50; ++q) {
+            int start = rng() % 100000;
+            int stop = start + rng() % 3000;
+            std::multiset<int> expected, actual;
+            for (const auto& i : all) {
+                if (i.stop >= start && i.start <= stop) {
+                    expected.insert(i.value);
+                }
+            }
+            tree.visit_overlapping(start, stop, [&](const ITree::interval& i) { actual.insert(i.value); });
+            REQUIRE( actual == expected );
+        }
+        std::size_t count = 0;
+        tree.visit_all([&](const ITree::interval&) { ++count; });
+        REQUIRE( count == all.size() );
+        REQUIRE( tree.findNearest(50000, 3).size() == 3 );
+    };
+
+    // small batches land in existing buckets, larger ones rebuild subtrees
+    for (int batch : { 1, 10, 500, 3000, 40000 }) {
+        ITree::interval_vector more = randomIntervals(batch, int(all.size()));
+        all.insert(all.end(), more.begin(), more.end());
+        tree.bulkInsert(std::move(more), 16, 16, 128);
+        check();
+    }
+
+    SECTION ("Batches concentrated in one region") {
+        for (int b = 0; b < 20; ++b) {
+            ITree::interval_vector more;
+            for (int i = 0; i < 200; ++i) {
+                int start = 40000 + rng() % 500;
+                more.push_back(ITree::interval(start, start + rng() % 50, int(all.size()) + i));
+            }
+            all.insert(all.end(), more.begin(), more.end());
+            tree.bulkInsert(std::move(more), 16, 16, 128);
+        }
+        check();
+        // about the same shape as building the tree from scratch
+        ITree::interval_vector copy = all;
+        const ITree::Stats fresh = ITree(std::move(copy), 16, 16, 128).stats();
+        const ITree::Stats grown = tree.stats();
+        REQUIRE( grown.depth <= fresh.depth + 1 );
+        REQUIRE( grown.bucketSizes.size() <= fresh.bucketSizes.size() + 1 );
+    }
+
+    SECTION ("Into an empty tree") {
+        ITree empty;
+        empty.bulkInsert({ {5, 10, 1}, {1, 2, 2} });
+        REQUIRE( empty.findOverlapping(2, 6).size() == 2 );
+        REQUIRE( empty.is_valid().first );
+    }
+}
+
+TEST_CASE( "Erasing intervals" ) {
+    typedef IntervalTree<int, int> ITree;
+    std::mt19937 rng(29);
+    ITree::interval_vector all;
+    for (int i = 0; i < 20000; ++i) {
+        int start = rng() % 100000;
+        all.push_back(ITree::interval(start, start + rng() % 1000, i));
+    }
+    ITree::interval_vector copy = all;
+    ITree tree(std::move(copy), 16, 16, 128);
+    auto check = [&]() {
+        REQUIRE( tree.is_valid().first );
+        std::size_t count = 0;
+        tree.visit_all([&](const ITree::interval&) { ++count; });
+        REQUIRE( count == all.size() );
+        for (int q = 0; q < 50; ++q) {
+            int start = rng() % 100000;
+            int stop = start + rng() % 3000;
+            std::multiset<int> expected, actual;
+            for (const auto& i : all) {
+                if (i.stop >= start && i.start <= stop) {
+                    expected.insert(i.value);
+                }
+            }
+            tree.visit_overlapping(start, stop, [&](const ITree::interval& i) { actual.insert(i.value); });
+            REQUIRE( actual == expected );
+            // nearest search relies on the subtree extents being kept up to date
+            auto nearest = tree.findNearest(start, 1);
+            REQUIRE( nearest.size() == 1 );
+            unsigned closest = std::numeric_limits<unsigned>::max();
+            for (const auto& i : all) {
+                closest = std::min(closest, ITree::distance(start, i.start, i.stop));
+            }
+            REQUIRE( ITree::distance(start, nearest[0].start, nearest[0].stop) == closest );
+        }
+    };
+    auto eraseFromModel = [&](std::function<bool(const ITree::interval&)> pred) {
+        const std::size_t before = all.size();
+        all.erase(std::remove_if(all.begin(), all.end(), pred), all.end());
+        return before - all.size();
+    };
+
+    REQUIRE( tree.eraseIf([](const ITree::interval& i) { return i.value % 3 == 0; })
+             == eraseFromModel([](const ITree::interval& i) { return i.value % 3 == 0; }) );
+    check();
+
+    for (int e = 0; e < 10; ++e) {
+        int start = rng() % 100000;
+        int stop = start + rng() % 10000;
+        REQUIRE( tree.eraseOverlapping(start, stop)
+                 == eraseFromModel([&](const ITree::interval& i) {
+                        return i.stop >= start && i.start <= stop;
+                    }) );
+    }
+    check();
+
+    // everything below 50000 goes, so whole subtrees are freed
+    REQUIRE( tree.eraseOverlapping(0, 50000)
+             == eraseFromModel([](const ITree::interval& i) { return i.start <= 50000; }) );
+    check();
+    REQUIRE( tree.eraseOverlapping(0, 50000) == 0 );
+
+    REQUIRE( tree.eraseIf([](const ITree::interval&) { return true; }) == all.size() );
+    all.clear();
+    REQUIRE( tree.empty() );
+    REQUIRE( tree.stats().nodes == 1 );
+    REQUIRE( tree.findOverlapping(0, 200000).empty() );
+}
+
+TEST_CASE( "Tree statistics" ) {
+    typedef IntervalTree<int, int> ITree;
+
+    SECTION ("Empty tree") {
+        ITree::Stats stats = ITree().stats();
+        REQUIRE( stats.nodes == 1 );
+        REQUIRE( stats.intervals == 0 );
+        REQUIRE( stats.bucketSizes.size() == 1 );
+    }
+
+    SECTION ("Counts add up") {
+        ITree::interval_vector intervals;
+        for (int i = 0; i < 1000; ++i) {
+            intervals.push_back(ITree::interval(i * 10, i * 10 + (i % 7 == 0 ? 5000 : 5), i));
+        }
+        const ITree tree(std::move(intervals), 16, 16, 64);
+        const ITree::Stats stats = tree.stats();
+        REQUIRE( stats.intervals == 1000 );
+        REQUIRE( stats.nodesPerLevel.size() == stats.depth );
+        REQUIRE( stats.nodesPerLevel[0] == 1 );
+        std::size_t nodes = 0, intervalsSeen = 0, buckets = 0;
+        for (std::size_t n : stats.nodesPerLevel) { nodes += n; }
+        for (std::size_t n : stats.intervalsPerLevel) { intervalsSeen += n; }
+        for (std::size_t n : stats.bucketSizes) { buckets += n; }
+        REQUIRE( nodes == stats.nodes );
+        REQUIRE( buckets == stats.nodes );
+        REQUIRE( intervalsSeen == 1000 );
+        REQUIRE( stats.centerSpanning > 0 );
+        REQUIRE( stats.centerSpanning < 1000 );
+        REQUIRE( stats.leaves < stats.nodes );
+        REQUIRE( stats.bytes >= stats.nodes * sizeof(ITree) + 1000 * sizeof(ITree::interval) );
+        REQUIRE( stats.slackBytes < stats.bytes );
+    }
+}
+
+TEST_CASE( "Query counters" ) {
+    typedef IntervalTree<int, int> ITree;
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 1000; ++i) {
+        intervals.push_back(ITree::interval(i * 10, i * 10 + 5, i));
+    }
+    const ITree tree(std::move(intervals), 16, 8, 64);
+
+    QueryCounters counters;
+    std::size_t hits = 0;
+    tree.visit_overlapping(5000, 5100, [&](const ITree::interval&) { ++hits; }, counters);
+    REQUIRE( hits == 11 );
+    REQUIRE( counters.intervalsReported == hits );
+    REQUIRE( counters.intervalsExamined >= hits );
+    REQUIRE( counters.nodesVisited >= 1 );
+    REQUIRE( counters.nodesVisited < tree.stats().nodes );
+    REQUIRE( counters.subtreesPruned > 0 );
+
+    counters.reset();
+    tree.visit_contained(5000, 5100, [&](const ITree::interval&) {}, counters);
+    REQUIRE( counters.intervalsReported == 10 );
+}
+
+TEST_CASE( "Coverage profile" ) {
+    typedef IntervalTree<int, int> ITree;
+
+    SECTION ("Hand-made example") {
+        const ITree tree({ {2, 5, 0}, {4, 8, 1}, {6, 8, 2}, {9, 9, 3} });
+        std::vector<std::vector<int> > segments;
+        tree.coverage(0, 12, [&](int s, int e, std::size_t d) { segments.push_back({ s, e, int(d) }); });
+        // 4..5 and 6..8 both have depth 2, so they form a single run
+        const std::vector<std::vector<int> > expected = {
+            { 0, 1, 0 }, { 2, 3, 1 }, { 4, 8, 2 }, { 9, 9, 1 }, { 10, 12, 0 }
+        };
+        REQUIRE( segments == expected );
+    }
+
+    SECTION ("Matches per-position depth") {
+        std::mt19937 rng(3);
+        ITree::interval_vector intervals;
+        for (int i = 0; i < 2000; ++i) {
+            int start = rng() % 10000;
+            intervals.push_back(ITree::interval(start, start + rng() % 100, i));
+        }
+        const ITree::interval_vector copy = intervals;
+        const ITree tree(std::move(intervals), 16, 8, 64);
+        for (int q = 0; q < 50; ++q) {
+            const int start = rng() % 10000;
+            const int stop = start + rng() % 500;
+            int expectedPos = start;
+            tree.coverage(start, stop, [&](int s, int e, std::size_t depth) {
+                REQUIRE( s == expectedPos );
+                REQUIRE( s <= e );
+                for (int pos = s; pos <= e; ++pos) {
+                    std::size_t d = 0;
+                    for (const auto& i : copy) {
+                        d += i.start <= pos && pos <= i.stop;
+                    }
+                    REQUIRE( d == depth );
+                }
+                expectedPos = e + 1;
+            });
+            REQUIRE( expectedPos == stop + 1 );
+        }
+    }
+
+    SECTION ("Range ending at the largest coordinate") {
+        const int top = std::numeric_limits<int>::max();
+        const ITree tree({ {top - 5, top, 0} });
+        std::size_t segments = 0;
+        tree.coverage(top - 10, top, [&](int, int e, std::size_t d) {
+            ++segments;
+            REQUIRE( (e == top) == (d == 1) );
+        });
+        REQUIRE( segments == 2 );
+    }
+
+    SECTION ("Coverage is swept without collecting the intervals") {
+        std::size_t segments = 0;
+        REQUIRE( sweepStreams([&](const IntervalTree<long, int>& points, long start, long stop) {
+            points.coverage(start, stop, [&](long, long, std::size_t) { ++segments; });
+        }) );
+        // each point and the gap after it, the last gap running to stop
+        REQUIRE( segments == std::size_t(2 * sweepPoints) );
+    }
+
+    SECTION ("Interval spanning every coordinate") {
+        const int bottom = std::numeric_limits<int>::min();
+        const int top = std::numeric_limits<int>::max();
+        ITree::interval_vector ivals({ {bottom, top, 0} });
+        for (int i = 1; i < 100; ++i) {
+            ivals.push_back(ITree::interval(bottom + i, bottom + i, i));
+            ivals.push_back(ITree::interval(top - i, top, 100 + i));
+        }
+        ITree tree(std::move(ivals), 16, 2, 4);
+        REQUIRE( tree.is_valid().first );
+        REQUIRE( tree.findOverlapping(0, 0).size() == 1 );
+        REQUIRE( tree.findOverlapping(top, top).size() == 100 );
+        REQUIRE( tree.findOverlapping(bottom, bottom + 1).size() == 2 );
+        tree.bulkInsert({ {top - 1000, top, 500} }, 16, 2, 4);
+        REQUIRE( tree.findOverlapping(top, top).size() == 101 );
+    }
+}
+
+TEST_CASE( "Aggregates over overlapping intervals" ) {
+    typedef IntervalTree<int, long> ITree;
+    std::mt19937 rng(5);
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 5000; ++i) {
+        int start = rng() % 100000;
+        intervals.push_back(ITree::interval(start, start + rng() % (i % 50 == 0 ? 20000 : 300),
+                                            long(rng() % 1000) - 500));
+    }
+    const ITree tree(std::move(intervals), 16, 16, 128);
+    const auto sum = tree.aggregator<SumAggregate<long> >();
+    const auto count = tree.aggregator<CountAggregate>();
+    const auto lowest = tree.aggregator(MinAggregate<long>());
+    const auto highest = tree.aggregator(MaxAggregate<long>());
+    for (int q = 0; q < 500; ++q) {
+        int start = rng() % 100000;
+        int stop = start + rng() % (q % 10 == 0 ? 100000 : 2000);
+        long expectedSum = 0;
+        long expectedMin = std::numeric_limits<long>::max();
+        long expectedMax = std::numeric_limits<long>::lowest();
+        std::size_t expectedCount = 0;
+        tree.visit_overlapping(start, stop, [&](const ITree::interval& i) {
+            expectedSum += i.value;
+            expectedMin = std::min(expectedMin, i.value);
+            expectedMax = std::max(expectedMax, i.value);
+            ++expectedCount;
+        });
+        REQUIRE( sum.aggregateOverlapping(start, stop) == expectedSum );
+        REQUIRE( count.aggregateOverlapping(start, stop) == expectedCount );
+        REQUIRE( lowest.aggregateOverlapping(start, stop) == expectedMin );
+        REQUIRE( highest.aggregateOverlapping(start, stop) == expectedMax );
+        REQUIRE( tree.aggregateOverlapping(start, stop, SumAggregate<long>()) == expectedSum );
+    }
+    REQUIRE( ITree().aggregator<CountAggregate>().aggregateOverlapping(0, 10) == 0 );
+}
+
+TEST_CASE( "Nearest intervals" ) {
+    typedef IntervalTree<std::size_t, int> ITree;
+    std::mt19937 rng(9);
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 3000; ++i) {
+        std::size_t start = rng() % 1000000;
+        intervals.push_back(ITree::interval(start, start + rng() % 200, i));
+    }
+    const ITree::interval_vector copy = intervals;
+    const ITree tree(std::move(intervals), 16, 8, 64);
+
+    for (int q = 0; q < 200; ++q) {
+        const std::size_t pos = rng() % 1100000;
+        const std::size_t k = 1 + q % 10;
+        std::vector<std::size_t> expected;
+        for (const auto& i : copy) {
+            expected.push_back(ITree::distance(pos, i.start, i.stop));
+        }
+        std::sort(expected.begin(), expected.end());
+        expected.resize(k);
+        std::vector<std::size_t> actual;
+        tree.visit_nearest(pos, k, [&](const ITree::interval& i) {
+            actual.push_back(ITree::distance(pos, i.start, i.stop));
+        });
+        REQUIRE( actual == expected );
+    }
+
+    REQUIRE( tree.findNearest(0, 0).empty() );
+    REQUIRE( tree.findNearest(0, 5000).size() == 3000 );
+    REQUIRE( ITree().findNearest(10, 3).empty() );
+
+    SECTION ("Distances spanning the whole coordinate range") {
+        typedef IntervalTree<int, int> IntTree;
+        const int min = std::numeric_limits<int>::min();
+        const int max = std::numeric_limits<int>::max();
+        const IntTree extremes({ {max - 1, max, 0}, {-100, -90, 1}, {min, min + 1, 2} });
+        IntTree::interval_vector nearest = extremes.findNearest(-5, 1);
+        REQUIRE( nearest.size() == 1 );
+        REQUIRE( nearest.front().value == 1 );
+        nearest = extremes.findNearest(min, 3);
+        REQUIRE( nearest.size() == 3 );
+        REQUIRE( nearest[0].value == 2 );
+        REQUIRE( nearest[1].value == 1 );
+        REQUIRE( nearest[2].value == 0 );
+        REQUIRE( IntTree::distance(min, max - 1, max) == std::numeric_limits<unsigned>::max() - 1 );
+        REQUIRE( IntTree::distance(max, min, min + 1) == std::numeric_limits<unsigned>::max() - 1 );
+    }
+}
+
+TEST_CASE( "Gaps between intervals" ) {
+    typedef IntervalTree<long, int> ITree;
+
+    SECTION ("Hand-made example") {
+        const ITree tree({ {2, 5, 0}, {4, 8, 1}, {10, 10, 2}, {20, 30, 3} });
+        std::vector<std::pair<long, long> > gaps;
+        tree.visit_gaps(0, 25, [&](long s, long e) { gaps.push_back(std::make_pair(s, e)); });
+        const std::vector<std::pair<long, long> > expected = { {0, 1}, {9, 9}, {11, 19} };
+        REQUIRE( gaps == expected );
+
+        gaps.clear();
+        tree.visit_gaps(3, 7, [&](long s, long e) { gaps.push_back(std::make_pair(s, e)); });
+        REQUIRE( gaps.empty() );
+
+        gaps.clear();
+        ITree().visit_gaps(3, 7, [&](long s, long e) { gaps.push_back(std::make_pair(s, e)); });
+        REQUIRE( gaps.size() == 1 );
+        REQUIRE( gaps.front() == std::make_pair(3L, 7L) );
+    }
+
+    SECTION ("Gaps are exactly the zero-depth coverage") {
+        std::mt19937 rng(13);
+        ITree::interval_vector intervals;
+        for (int i = 0; i < 1000; ++i) {
+            long start = rng() % 100000;
+            intervals.push_back(ITree::interval(start, start + rng() % 80, i));
+        }
+        const ITree tree(std::move(intervals), 16, 8, 64);
+        for (int q = 0; q < 100; ++q) {
+            const long start = rng() % 100000;
+            const long stop = start + rng() % 3000;
+            std::vector<std::pair<long, long> > gaps, zeros;
+            tree.visit_gaps(start, stop, [&](long s, long e) { gaps.push_back(std::make_pair(s, e)); });
+            tree.coverage(start, stop, [&](long s, long e, std::size_t depth) {
+                if (depth == 0) {
+                    zeros.push_back(std::make_pair(s, e));
+                }
+            });
+            REQUIRE( gaps == zeros );
+        }
+    }
+
+    SECTION ("Gaps are found without collecting the intervals") {
+        std::size_t gaps = 0;
+        REQUIRE( sweepStreams([&](const ITree& points, long start, long stop) {
+            points.visit_gaps(start, stop, [&](long, long) { ++gaps; });
+        }) );
+        REQUIRE( gaps == std::size_t(sweepPoints) );
+    }
+}
+
+TEST_CASE( "Merged intervals" ) {
+    typedef IntervalTree<long, int> ITree;
+    typedef std::vector<std::pair<long, long> > Ranges;
+    const ITree tree({ {2, 5, 0}, {4, 8, 1}, {9, 9, 2}, {12, 14, 3}, {30, 40, 4}, {33, 35, 5} });
+    auto merged = [&](long start, long stop, long tolerance) {
+        Ranges ranges;
+        tree.visit_merged(start, stop,
+                          [&](long s, long e) { ranges.push_back(std::make_pair(s, e)); },
+                          tolerance);
+        return ranges;
+    };
+
+    REQUIRE( merged(0, 100, 0) == Ranges({ {2, 8}, {9, 9}, {12, 14}, {30, 40} }) );
+    REQUIRE( merged(0, 100, 1) == Ranges({ {2, 9}, {12, 14}, {30, 40} }) );
+    REQUIRE( merged(0, 100, 3) == Ranges({ {2, 14}, {30, 40} }) );
+    // ranges are not clipped to the query
+    REQUIRE( merged(7, 13, 0) == Ranges({ {4, 8}, {9, 9}, {12, 14} }) );
+    REQUIRE( merged(36, 36, 0) == Ranges({ {30, 40} }) );
+    REQUIRE( merged(20, 25, 0).empty() );
+
+    SECTION ("Gaps spanning the whole coordinate range") {
+        typedef IntervalTree<int, int> IntTree;
+        const int min = std::numeric_limits<int>::min();
+        const int max = std::numeric_limits<int>::max();
+        const IntTree extremes({ {min, min + 1, 0}, {max - 1, max, 1} });
+        std::vector<std::pair<int, int> > ranges;
+        extremes.visit_merged(min, max, [&](int s, int e) { ranges.push_back(std::make_pair(s, e)); }, 5);
+        REQUIRE( ranges == (std::vector<std::pair<int, int> >{ {min, min + 1}, {max - 1, max} }) );
+    }
+
+    SECTION ("Merged ranges cover exactly the non-gaps") {
+        std::mt19937 rng(17);
+        ITree::interval_vector intervals;
+        for (int i = 0; i < 1000; ++i) {
+            long start = rng() % 100000;
+            intervals.push_back(ITree::interval(start, start + rng() % 80, i));
+        }
+        const ITree random(std::move(intervals), 16, 8, 64);
+        for (int q = 0; q < 100; ++q) {
+            const long start = rng() % 100000;
+            const long stop = start + rng() % 3000;
+            // clip the merged ranges and fill in the gaps: together they tile [start, stop]
+            Ranges tiles;
+            random.visit_merged(start, stop, [&](long s, long e) {
+                tiles.push_back(std::make_pair(std::max(s, start), std::min(e, stop)));
+            }, 1L);
+            random.visit_gaps(start, stop, [&](long s, long e) { tiles.push_back(std::make_pair(s, e)); });
+            std::sort(tiles.begin(), tiles.end());
+            long next = start;
+            for (const auto& t : tiles) {
+                REQUIRE( t.first == next );
+                next = t.second + 1;
+            }
+            REQUIRE( next == stop + 1 );
+        }
+    }
+
+    SECTION ("Ranges are merged without collecting the intervals") {
+        for (long tolerance : { 0L, 2L }) {
+            std::size_t ranges = 0;
+            REQUIRE( sweepStreams([&](const ITree& points, long start, long stop) {
+                points.visit_merged(start, stop, [&](long, long) { ++ranges; }, tolerance);
+            }) );
+            // points two apart merge into one range once the gap is tolerated
+            REQUIRE( ranges == (tolerance == 0 ? std::size_t(sweepPoints) : 1) );
+        }
+    }
+}
+
+TEST_CASE( "Ordered iteration" ) {
+    typedef IntervalTree<int, int> ITree;
+    std::mt19937 rng(19);
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 3000; ++i) {
+        int start = rng() % 100000;
+        intervals.push_back(ITree::interval(start, start + rng() % (i % 100 == 0 ? 30000 : 300), i));
+    }
+    const ITree::interval_vector copy = intervals;
+    const ITree tree(std::move(intervals), 16, 8, 64);
+
+    SECTION ("Whole tree in start order") {
+        REQUIRE( std::distance(tree.begin(), tree.end()) == 3000 );
+        REQUIRE( std::is_sorted(tree.begin(), tree.end(), ITree::IntervalStartCmp()) );
+        std::multiset<int> values;
+        for (const auto& i : tree) {
+            values.insert(i.value);
+        }
+        REQUIRE( values.size() == 3000 );
+        REQUIRE( *values.begin() == 0 );
+        REQUIRE( *values.rbegin() == 2999 );
+        REQUIRE( ITree().begin() == ITree().end() );
+    }
+
+    SECTION ("Overlapping range matches visit_overlapping") {
+        for (int q = 0; q < 200; ++q) {
+            const int start = rng() % 100000;
+            const int stop = start + rng() % 2000;
+            std::multiset<int> expected, actual;
+            tree.visit_overlapping(start, stop, [&](const ITree::interval& i) { expected.insert(i.value); });
+            int previous = std::numeric_limits<int>::min();
+            for (const auto& i : tree.overlapping_range(start, stop)) {
+                REQUIRE( i.start >= previous );
+                previous = i.start;
+                actual.insert(i.value);
+            }
+            REQUIRE( actual == expected );
+        }
+    }
+
+    SECTION ("Iterators work with standard algorithms") {
+        auto range = tree.overlapping_range(50000, 51000);
+        auto first = range.begin();
+        auto copyOfFirst = first;
+        REQUIRE( first == copyOfFirst );
+        auto long_one = std::find_if(range.begin(), range.end(),
+                                     [](const ITree::interval& i) { return i.stop - i.start > 300; });
+        if (long_one != range.end()) {
+            REQUIRE( long_one->stop - long_one->start > 300 );
+        }
+        REQUIRE( std::count_if(range.begin(), range.end(), [](const ITree::interval&) { return true; })
+                 == (long) tree.findOverlapping(50000, 51000).size() );
+    }
+}
+
+TEST_CASE( "Interleaved batch queries" ) {
+    typedef IntervalTree<long, int> ITree;
+    std::mt19937 rng(23);
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 5000; ++i) {
+        long start = rng() % 100000;
+        intervals.push_back(ITree::interval(start, start + rng() % 500, i));
+    }
+    const ITree tree(std::move(intervals), 16, 8, 64);
+    ITree::interval_vector queries;
+    for (int q = 0; q < 300; ++q) {
+        long start = rng() % 100000;
+        queries.push_back(ITree::interval(start, start + rng() % 2000, q));
+    }
+
+    for (std::size_t group : { 1, 3, 16, 1000 }) {
+        std::vector<std::vector<int> > batched(queries.size());
+        tree.visit_overlapping_batch(queries, [&](std::size_t q, const ITree::interval& i) {
+            batched[q].push_back(i.value);
+        }, group);
+        for (std::size_t q = 0; q != queries.size(); ++q) {
+            std::vector<int> single;
+            tree.visit_overlapping(queries[q].start, queries[q].stop,
+                                   [&](const ITree::interval& i) { single.push_back(i.value); });
+            REQUIRE( batched[q] == single );
+        }
+    }
+
+    bool called = false;
+    tree.visit_overlapping_batch(ITree::interval_vector(),
+                                 [&](std::size_t, const ITree::interval&) { called = true; });
+    ITree().visit_overlapping_batch(queries,
+                                    [&](std::size_t, const ITree::interval&) { called = true; });
+    REQUIRE( !called );
+}
+
+#ifdef INTERVAL_TREE_HAS_COROUTINES
+// the header leaves common names such as Generator to its users
+template <class T>
+struct Generator {};
+
+TEST_CASE( "Coroutine query generator" ) {
+    typedef IntervalTree<int, int> ITree;
+    std::mt19937 rng(23);
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 2000; ++i) {
+        int start = rng() % 100000;
+        intervals.push_back(ITree::interval(start, start + rng() % 500, i));
+    }
+    const ITree tree(std::move(intervals), 16, 8, 64);
+
+    SECTION ("Yields what the ordered range yields") {
+        std::vector<int> expected, actual;
+        for (const auto& i : tree.overlapping_range(10000, 20000)) {
+            expected.push_back(i.value);
+        }
+        for (const auto& i : tree.overlapping(10000, 20000)) {
+            actual.push_back(i.value);
+        }
+        REQUIRE( actual == expected );
+        REQUIRE( !actual.empty() );
+    }
+
+    SECTION ("Interleaved and stopped early") {
+        auto a = tree.overlapping(0, 50000);
+        auto b = tree.overlapping(50000, 100000);
+        auto i = a.begin();
+        auto j = b.begin();
+        int taken = 0;
+        for (; taken < 3 && i != a.end() && j != b.end(); ++taken, ++i, ++j) {
+            REQUIRE( i->start <= 50000 );
+            REQUIRE( j->stop >= 50000 );
+        }
+        REQUIRE( taken == 3 );
+    }
+
+    SECTION ("Empty tree") {
+        const ITree empty;
+        auto g = empty.overlapping(0, 10);
+        REQUIRE( !(g.begin() != g.end()) );
+    }
+}
+#endif
+
+std::string temporaryPath() {
+    char path[] = "/tmp/interval_tree_test_XXXXXX";
+    int fd = mkstemp(path);
+    REQUIRE( fd >= 0 );
+    close(fd);
+    return path;
+}
+
+TEST_CASE( "Mapped index answers queries like the tree" ) {
+    typedef IntervalTree<int, int> ITree;
+    std::mt19937 rng(42);
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 5000; ++i) {
+        int start = rng() % 100000;
+        intervals.push_back(ITree::interval(start, start + rng() % 1000, i));
+    }
+    const ITree tree(std::move(intervals), 16, 1);
+    const std::string path = temporaryPath();
+    writeIndex(path, tree);
+
+    MappedIntervalTree<int, int> mapped(path);
+    for (int q = 0; q < 500; ++q) {
+        int start = rng() % 100000;
+        int stop = start + rng() % 2000;
+        std::multiset<int> expected, actual;
+        tree.visit_overlapping(start, stop, [&](const ITree::interval& i) { expected.insert(i.value); });
+        mapped.visit_overlapping(start, stop, [&](const ITree::interval& i) { actual.insert(i.value); });
+        REQUIRE( actual == expected );
+        REQUIRE( mapped.findContained(start, stop).size() == tree.findContained(start, stop).size() );
+    }
+
+    SECTION ("Every node layout answers queries like the tree") {
+        for (IndexLayout layout : { PreorderLayout, BreadthFirstLayout, VanEmdeBoasLayout }) {
+            writeIndex(path, tree, layout);
+            MappedIntervalTree<int, int> laidOut(path);
+            laidOut.verify();
+            std::size_t all = 0;
+            laidOut.visit_all([&](const ITree::interval&) { ++all; });
+            REQUIRE( all == 5000 );
+            for (int q = 0; q < 100; ++q) {
+                int start = rng() % 100000;
+                int stop = start + rng() % 2000;
+                std::multiset<int> expected, actual;
+                tree.visit_overlapping(start, stop, [&](const ITree::interval& i) { expected.insert(i.value); });
+                laidOut.visit_overlapping(start, stop, [&](const ITree::interval& i) { actual.insert(i.value); });
+                REQUIRE( actual == expected );
+            }
+        }
+    }
+
+    SECTION ("Moved-from index is empty") {
+        MappedIntervalTree<int, int> other(std::move(mapped));
+        REQUIRE( mapped.empty() );
+        REQUIRE( !other.empty() );
+    }
+
+    SECTION ("Mismatched interval type is rejected") {
+        REQUIRE_THROWS( (MappedIntervalTree<long, int>(path)) );
+    }
+
+    SECTION ("Corrupt indexes are rejected") {
+        std::ifstream in(path.c_str(), std::ios::binary);
+        const std::string good((std::istreambuf_iterator<char>(in)), std::istreambuf_iterator<char>());
+        IndexHeader header;
+        std::memcpy(&header, good.data(), sizeof(header));
+        auto corrupt = [&](std::size_t offset, std::uint64_t value) {
+            std::string bytes = good;
+            std::memcpy(&bytes[offset], &value, sizeof(value));
+            std::ofstream out(path.c_str(), std::ios::binary | std::ios::trunc);
+            out.write(bytes.data(), bytes.size());
+        };
+        const std::uint64_t huge = std::uint64_t(1) << 62;
+        for (std::uint64_t value : { huge, ~std::uint64_t(0) / sizeof(IndexNode<int>) + 2 }) {
+            corrupt(offsetof(IndexHeader, nodeCount), value);
+            REQUIRE_THROWS( (MappedIntervalTree<int, int>(path)) );
+            REQUIRE_THROWS( (PagedIntervalTree<int, int>(path)) );
+        }
+        corrupt(offsetof(IndexHeader, intervalCount), huge);
+        REQUIRE_THROWS( (MappedIntervalTree<int, int>(path)) );
+        corrupt(offsetof(IndexHeader, root), header.nodeCount);
+        REQUIRE_THROWS( (MappedIntervalTree<int, int>(path)) );
+        corrupt(offsetof(IndexHeader, nodesOffset), header.nodesOffset + 1);
+        REQUIRE_THROWS( (MappedIntervalTree<int, int>(path)) );
+
+        // a child index out of range is only found by reading the nodes
+        corrupt(header.nodesOffset + offsetof(IndexNode<int>, left), header.nodeCount + 7);
+        MappedIntervalTree<int, int> unchecked(path);
+        REQUIRE_THROWS( unchecked.verify() );
+        REQUIRE_THROWS( (PagedIntervalTree<int, int>(path)) );
+        // as is a node referring back to the root
+        corrupt(header.nodesOffset + offsetof(IndexNode<int>, left), header.root);
+        REQUIRE_THROWS( (MappedIntervalTree<int, int>(path).verify()) );
+        corrupt(header.nodesOffset + offsetof(IndexNode<int>, end), header.intervalCount + 1);
+        REQUIRE_THROWS( (MappedIntervalTree<int, int>(path).verify()) );
+        REQUIRE_THROWS( (PagedIntervalTree<int, int>(path)) );
+        // nodes past the resident ones are checked when a query reads them
+        const std::size_t last = header.nodesOffset + (header.nodeCount - 1) * sizeof(IndexNode<int>);
+        corrupt(last + offsetof(IndexNode<int>, end), header.intervalCount + 1);
+        PagedIntervalTree<int, int> lazy(path, 4096, sizeof(IndexNode<int>));
+        REQUIRE_THROWS( lazy.visit_all([](const ITree::interval&) {}) );
+
+        corrupt(0, 0);
+        REQUIRE_THROWS( (MappedIntervalTree<int, int>(path)) );
+        writeIndex(path, tree);
+        MappedIntervalTree<int, int>(path).verify();
+    }
+
+    SECTION ("Empty tree round-trips") {
+        writeIndex(path, ITree());
+        MappedIntervalTree<int, int> empty(path);
+        REQUIRE( empty.empty() );
+        REQUIRE( empty.findOverlapping(0, 100).empty() );
+    }
+    unlink(path.c_str());
+}
+
+TEST_CASE( "Paged index answers queries like the tree" ) {
+    typedef IntervalTree<int, int> ITree;
+    std::mt19937 rng(11);
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 5000; ++i) {
+        int start = rng() % 100000;
+        intervals.push_back(ITree::interval(start, start + rng() % 1000, i));
+    }
+    const ITree tree(std::move(intervals), 16, 1, 64);
+    const std::string path = temporaryPath();
+    writeIndex(path, tree);
+
+    const std::size_t cacheBytes = 4096;
+    PagedIntervalTree<int, int> paged(path, cacheBytes);
+    for (int q = 0; q < 500; ++q) {
+        int start = rng() % 100000;
+        int stop = start + rng() % 2000;
+        std::multiset<int> expected, actual;
+        tree.visit_overlapping(start, stop, [&](const ITree::interval& i) { expected.insert(i.value); });
+        paged.visit_overlapping(start, stop, [&](const ITree::interval& i) { actual.insert(i.value); });
+        REQUIRE( actual == expected );
+        REQUIRE( paged.findContained(start, stop).size() == tree.findContained(start, stop).size() );
+    }
+    // a bucket larger than the whole cache is still cached on its own
+    REQUIRE( paged.cachedBytes() > 0 );
+    REQUIRE( paged.cachedBytes() < 5000 * sizeof(ITree::interval) / 4 );
+    std::size_t all = 0;
+    paged.visit_all([&](const ITree::interval&) { ++all; });
+    REQUIRE( all == 5000 );
+
+    // with only the root resident, the other nodes are paged in blocks
+    for (IndexLayout layout : { PreorderLayout, BreadthFirstLayout, VanEmdeBoasLayout }) {
+        writeIndex(path, tree, layout);
+        PagedIntervalTree<int, int> lean(path, cacheBytes, sizeof(IndexNode<int>));
+        REQUIRE( lean.residentBytes() == sizeof(IndexNode<int>) );
+        for (int q = 0; q < 100; ++q) {
+            int start = rng() % 100000;
+            int stop = start + rng() % 2000;
+            REQUIRE( lean.findOverlapping(start, stop).size() == tree.findOverlapping(start, stop).size() );
+        }
+        REQUIRE( lean.cachedBytes() < 5000 * sizeof(ITree::interval) / 4 );
+    }
+    unlink(path.c_str());
+}
+
+TEST_CASE( "Compressed buckets answer queries like the tree" ) {
+    typedef IntervalTree<std::size_t, int> ITree;
+    std::mt19937 rng(5);
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 50000; ++i) {
+        // mostly short intervals, a few needing wide lengths
+        std::size_t start = rng() % 10000000;
+        std::size_t length = i % 100 == 0 ? std::size_t(rng()) * 4096 : rng() % 300;
+        intervals.push_back(ITree::interval(start, start + length, i));
+    }
+    const ITree tree(std::move(intervals));
+    typedef CompressedIntervalTree<std::size_t, int> Compressed;
+    const Compressed compressed(tree);
+    REQUIRE( compressed.size() == 50000 );
+    REQUIRE( compressed.bytes() < tree.stats().bytes / 2 );
+
+    for (int q = 0; q < 500; ++q) {
+        std::size_t start = rng() % 10000000;
+        std::size_t stop = start + rng() % 20000;
+        std::multiset<std::tuple<std::size_t, std::size_t, int> > expected, actual;
+        tree.visit_overlapping(start, stop, [&](const ITree::interval& i) {
+            expected.insert(std::make_tuple(i.start, i.stop, i.value));
+        });
+        compressed.visit_overlapping(start, stop, [&](const Compressed::interval& i) {
+            actual.insert(std::make_tuple(i.start, i.stop, *i.value));
+        });
+        REQUIRE( actual == expected );
+        REQUIRE( compressed.findContained(start, stop).size() == tree.findContained(start, stop).size() );
+    }
+
+    SECTION ("Negative coordinates round-trip") {
+        const IntervalTree<int, int> signedTree({ {-5, 3, 0}, {-100000, -99990, 1}, {7, 70000, 2} });
+        const CompressedIntervalTree<int, int> signedCompressed(signedTree);
+        auto found = signedCompressed.findOverlapping(-99995, 0);
+        REQUIRE( found.size() == 2 );
+        REQUIRE( signedCompressed.findContained(-200000, 100000).size() == 3 );
+    }
+
+    SECTION ("Values are not copied") {
+        typedef IntervalTree<int, CopyCounted> CTree;
+        CTree::interval_vector counted;
+        for (int i = 0; i < 1000; ++i) {
+            counted.emplace_back(i * 10, i * 10 + 25, CopyCounted(i));
+        }
+        const CompressedIntervalTree<int, CopyCounted> compressedCounted((CTree(std::move(counted))));
+        CopyCounted::copies = 0;
+        std::size_t hits = 0;
+        compressedCounted.visit_overlapping(100, 5000, [&](const Interval<int, const CopyCounted*>& i) {
+            REQUIRE( i.value->id * 10 == i.start );
+            ++hits;
+        });
+        REQUIRE( hits > 400 );
+        REQUIRE( CopyCounted::copies == 0 );
+    }
 
-    // a simple sanity check
+    SECTION ("Empty tree") {
+        const CompressedIntervalTree<std::size_t, int> empty((ITree()));
+        REQUIRE( empty.empty() );
+        REQUIRE( empty.findOverlapping(0, 100).empty() );
+    }
+}
+
+TEST_CASE( "Values held outside the tree" ) {
+    typedef IntervalTree<int, std::string> ITree;
+    typedef IndexedIntervalTree<int, std::string> Indexed;
+    std::mt19937 rng(31);
+    ITree::interval_vector intervals;
+    for (int i = 0; i < 3000; ++i) {
+        int start = rng() % 50000;
+        intervals.push_back(ITree::interval(start, start + rng() % 400,
+                                            std::string(100, 'a' + i % 26) + std::to_string(i)));
+    }
+    ITree::interval_vector copy = intervals;
+    const ITree tree(std::move(intervals));
+    const Indexed indexed(std::move(copy), 16, 8, 64);
+    REQUIRE( indexed.size() == 3000 );
+    REQUIRE( sizeof(Indexed::interval) < sizeof(ITree::interval) );
+
+    for (int q = 0; q < 300; ++q) {
+        int start = rng() % 50000;
+        int stop = start + rng() % 1000;
+        std::multiset<std::string> expected, actual;
+        tree.visit_overlapping(start, stop, [&](const ITree::interval& i) { expected.insert(i.value); });
+        indexed.visit_overlapping(start, stop, [&](const Indexed::interval& i) {
+            actual.insert(indexed.value(i));
+        });
+        REQUIRE( actual == expected );
+        REQUIRE( indexed.findContained(start, stop).size() == tree.findContained(start, stop).size() );
+    }
+
+    Indexed mutableValues({ {1, 5, "x"} });
+    for (const auto& i : mutableValues.findOverlapping(2, 2)) {
+        mutableValues.value(i) += "y";
+    }
+    REQUIRE( mutableValues.value(mutableValues.findOverlapping(3, 3).front()) == "xy" );
+    REQUIRE( Indexed().empty() );
+}
+
+TEST_CASE( "Persistent versions" ) {
+    typedef PersistentIntervalTree<int, int> PTree;
+    typedef std::vector<std::tuple<int, int, int> > Triples;
+    std::mt19937 rng(3);
+    PTree::interval_vector model;
+    for (int i = 0; i < 2000; ++i) {
+        int start = rng() % 20000;
+        model.push_back(PTree::interval(start, start + rng() % 200, i));
+    }
+    PTree::interval_vector initial = model;
+    std::vector<PTree> versions(1, PTree(std::move(initial), 16, 16, 64));
+    std::vector<PTree::interval_vector> models(1, model);
+
+    auto overlapping = [](const PTree::interval_vector& ivals, int start, int stop) {
+        Triples result;
+        for (const auto& i : ivals) {
+            if (i.stop >= start && i.start <= stop) {
+                result.push_back(std::make_tuple(i.start, i.stop, i.value));
+            }
+        }
+        std::sort(result.begin(), result.end());
+        return result;
+    };
+    auto check = [&](const PTree& tree, const PTree::interval_vector& ivals) {
+        REQUIRE( tree.size() == ivals.size() );
+        for (int q = 0; q < 20; ++q) {
+            int start = rng() % 20000;
+            int stop = start + rng() % 500;
+            Triples actual;
+            tree.visit_overlapping(start, stop, [&](const PTree::interval& i) {
+                actual.push_back(std::make_tuple(i.start, i.stop, i.value));
+            });
+            std::sort(actual.begin(), actual.end());
+            REQUIRE( actual == overlapping(ivals, start, stop) );
+        }
+    };
+
+    for (int step = 0; step < 400; ++step) {
+        if (step % 3 == 2 && !model.empty()) {
+            std::size_t k = rng() % model.size();
+            versions.push_back(versions.back().erase(model[k]));
+            model.erase(model.begin() + k);
+        } else {
+            int start = rng() % 20000;
+            PTree::interval i(start, start + rng() % 200, 2000 + step);
+            versions.push_back(versions.back().insert(i));
+            model.push_back(i);
+        }
+        models.push_back(model);
+    }
+    // every version still answers as it did when it was made
+    for (std::size_t v = 0; v < versions.size(); v += 37) {
+        check(versions[v], models[v]);
+    }
+    check(versions.back(), models.back());
+
+    SECTION ("Erasing a missing interval keeps the version") {
+        const PTree& last = versions.back();
+        PTree same = last.erase(PTree::interval(-5, -1, 0));
+        REQUIRE( same.size() == last.size() );
+    }
+
+    SECTION ("Emptied and empty trees") {
+        PTree tree;
+        REQUIRE( tree.empty() );
+        PTree one = tree.insert(PTree::interval(1, 2, 3));
+        REQUIRE( one.findOverlapping(2, 2).size() == 1 );
+        REQUIRE( tree.findOverlapping(2, 2).empty() );
+        PTree none = one.erase(PTree::interval(1, 2, 3));
+        REQUIRE( none.empty() );
+        REQUIRE( none.findOverlapping(0, 10).empty() );
+    }
+}
+
+TEST_CASE( "Atomically published trees" ) {
+    typedef IntervalTree<int, int> ITree;
+    // version k holds k intervals, all with value k
+    auto version = [](int k) {
+        ITree::interval_vector intervals;
+        for (int i = 0; i < k; ++i) {
+            intervals.push_back(ITree::interval(i, i + 10, k));
+        }
+        return ITree(std::move(intervals), 16, 4, 16);
+    };
+    AtomicIntervalTree<ITree> shared(version(1));
+    REQUIRE( shared.read()->findOverlapping(0, 0).size() == 1 );
+
+    std::atomic<bool> done(false);
+    std::atomic<int> inconsistent(0);
+    std::atomic<long> reads(0);
+    std::vector<std::thread> readers;
+    for (int t = 0; t < 4; ++t) {
+        readers.push_back(std::thread([&]() {
+            while (!done.load()) {
+                auto tree = shared.read();
+                std::size_t count = 0;
+                int seen = -1;
+                tree->visit_all([&](const ITree::interval& i) {
+                    if (seen != -1 && seen != i.value) {
+                        ++inconsistent;
+                    }
+                    seen = i.value;
+                    ++count;
+                });
+                if (seen != int(count)) {
+                    ++inconsistent;
+                }
+                ++reads;
+            }
+        }));
+    }
+    for (int k = 2; k <= 200; ++k) {
+        shared.publish(version(k));
+    }
+    done = true;
+    for (auto& t : readers) {
+        t.join();
+    }
+    REQUIRE( inconsistent == 0 );
+    REQUIRE( reads > 0 );
+    REQUIRE( shared.read()->findOverlapping(0, 1000).size() == 200 );
+}
+
+TEST_CASE( "Loading tab-delimited interval files" ) {
+    const std::string path = temporaryPath();
+
+    SECTION ("BED is converted to 1-based closed coordinates and grouped by contig") {
+        FILE* f = fopen(path.c_str(), "w");
+        fputs("track name=test\n"
+              "# comment\n"
+              "chr1\t10\t20\tgeneA\n"
+              "chr1\t15\t16\tgeneB\r\n"
+              "chr2\t5\t5\tinsertion\n"
+              "chr1\t30\t40\tgeneC", f);
+        fclose(f);
+        for (unsigned threads = 1; threads <= 4; ++threads) {
+            auto contigs = loadIntervals<int, std::string>(
+                path, BED, [](const IntervalRecord<int>& r) { return r.field(3).str(); },
+                threads);
+            REQUIRE( contigs.size() == 2 );
+            const auto& chr1 = contigs["chr1"];
+            REQUIRE( chr1.size() == 3 );
+            REQUIRE( chr1[0].start == 11 );
+            REQUIRE( chr1[0].stop == 20 );
+            REQUIRE( chr1[0].value == "geneA" );
+            REQUIRE( chr1[1].start == 16 );
+            REQUIRE( chr1[1].stop == 16 );
+            REQUIRE( chr1[1].value == "geneB" );
+            REQUIRE( chr1[2].value == "geneC" );
+            REQUIRE( contigs["chr2"][0].start == 6 );
+            REQUIRE( contigs["chr2"][0].stop == 6 );
+        }
+    }
+
+    SECTION ("GFF and VCF coordinates") {
+        FILE* f = fopen(path.c_str(), "w");
+        fputs("##gff-version 3\n"
+              "chr1\tsrc\tgene\t100\t200\t.\t+\t.\tID=g1\n", f);
+        fclose(f);
+        auto gff = loadIntervalTree<long, int>(path, GFF, [](const IntervalRecord<long>&) { return 1; });
+        REQUIRE( gff.findOverlapping(200, 200).size() == 1 );
+        REQUIRE( gff.findOverlapping(201, 300).empty() );
+
+        f = fopen(path.c_str(), "w");
+        fputs("##fileformat=VCFv4.2\n"
+              "#CHROM\tPOS\tID\tREF\tALT\n"
+              "chr1\t50\trs1\tACGT\tA\n", f);
+        fclose(f);
+        auto vcf = loadIntervalTree<long, int>(path, VCF, [](const IntervalRecord<long>&) { return 1; });
+        REQUIRE( vcf.findOverlapping(53, 53).size() == 1 );
+        REQUIRE( vcf.findOverlapping(54, 54).empty() );
+
+        // the same feature in BED and GFF loads as the same interval
+        f = fopen(path.c_str(), "w");
+        fputs("chr1\t99\t200\n", f);
+        fclose(f);
+        auto bed = loadIntervalTree<long, int>(path, BED, [](const IntervalRecord<long>&) { return 1; });
+        REQUIRE( bed.findOverlapping(99, 99).empty() );
+        REQUIRE( bed.findContained(100, 200).size() == 1 );
+    }
+
+    SECTION ("Malformed coordinates are reported") {
+        FILE* f = fopen(path.c_str(), "w");
+        fputs("chr1\tten\t20\n", f);
+        fclose(f);
+        REQUIRE_THROWS( (loadIntervals<int, int>(path, BED, [](const IntervalRecord<int>&) { return 0; })) );
+    }
+
+    SECTION ("Out of range coordinates are reported") {
+        auto loads = [&](const char* line) {
+            FILE* f = fopen(path.c_str(), "w");
+            fputs(line, f);
+            fclose(f);
+            auto value = [](const IntervalRecord<std::size_t>&) { return 0; };
+            try {
+                loadIntervals<std::size_t, int>(path, BED, value);
+                return true;
+            } catch (const std::runtime_error&) {
+                return false;
+            }
+        };
+        REQUIRE( !loads("chr1\t-5\t20\n") );
+        REQUIRE( !loads("chr1\t12345678901234567890123\t20\n") );
+        REQUIRE( !loads("chr1\t18446744073709551616\t20\n") );
+        REQUIRE( loads("chr1\t18446744073709551614\t18446744073709551615\n") );
+        REQUIRE( !loads("chr1\t18446744073709551615\t18446744073709551615\n") );
+
+        FILE* f = fopen(path.c_str(), "w");
+        fputs("chr1\t-2147483648\t2147483647\n", f);
+        fclose(f);
+        auto extremes = loadIntervals<int, int>(path, BED, [](const IntervalRecord<int>&) { return 0; });
+        REQUIRE( extremes["chr1"][0].start == std::numeric_limits<int>::min() + 1 );
+        f = fopen(path.c_str(), "w");
+        fputs("chr1\t-2147483649\t0\n", f);
+        fclose(f);
+        REQUIRE_THROWS( (loadIntervals<int, int>(path, BED, [](const IntervalRecord<int>&) { return 0; })) );
+
+        // the end of a VCF REF allele past the maximum
+        f = fopen(path.c_str(), "w");
+        fputs("chr1\t2147483647\trs1\tACGT\tA\n", f);
+        fclose(f);
+        REQUIRE_THROWS( (loadIntervals<int, int>(path, VCF, [](const IntervalRecord<int>&) { return 0; })) );
+        f = fopen(path.c_str(), "w");
+        fputs("chr1\t2147483644\trs1\tACGT\tA\n", f);
+        fclose(f);
+        extremes = loadIntervals<int, int>(path, VCF, [](const IntervalRecord<int>&) { return 0; });
+        REQUIRE( extremes["chr1"][0].stop == std::numeric_limits<int>::max() );
+    }
+
+    SECTION ("Empty files load on any number of threads") {
+        FILE* f = fopen(path.c_str(), "w");
+        fclose(f);
+        for (unsigned threads = 1; threads <= 4; ++threads) {
+            REQUIRE( (loadIntervals<int, int>(path, BED, [](const IntervalRecord<int>&) { return 0; },
+                                              threads)).empty() );
+        }
+    }
+    unlink(path.c_str());
+}
+
+TEST_CASE( "Forest of per-contig trees" ) {
+    typedef IntervalTree<int, int> ITree;
+    typedef IntervalForest<std::string, ITree> Forest;
+    std::mt19937 rng(7);
+    std::map<std::string, ITree::interval_vector> contigs;
+    const char* names[] = { "chr1", "chr2", "chr3", "chrX" };
+    for (int i = 0; i < 4000; ++i) {
+        int start = rng() % 10000;
+        contigs[names[i % 4]].push_back(ITree::interval(start, start + rng() % 100, i));
+    }
+    std::map<std::string, ITree::interval_vector> copy = contigs;
+    const Forest forest(std::move(copy), 3, 16, 1);
+    REQUIRE( forest.size() == 4 );
+    REQUIRE( forest.find("chrY") == nullptr );
+    REQUIRE( forest.findOverlapping("chrY", 0, 10000).empty() );
+
+    std::vector<Forest::Query> queries;
+    for (int q = 0; q < 200; ++q) {
+        int start = rng() % 10000;
+        Forest::Query query = { names[rng() % 4], start, start + int(rng() % 500) };
+        queries.push_back(query);
+    }
+    std::vector<std::size_t> counts(queries.size());
+    forest.visit_overlapping(queries, [&](std::size_t q, const ITree::interval&) { ++counts[q]; });
+    for (std::size_t q = 0; q != queries.size(); ++q) {
+        std::size_t expected = 0;
+        for (const auto& i : contigs[queries[q].key]) {
+            if (i.stop >= queries[q].start && i.start <= queries[q].stop) {
+                ++expected;
+            }
+        }
+        REQUIRE( counts[q] == expected );
+        REQUIRE( forest.findOverlapping(queries[q].key, queries[q].start, queries[q].stop).size() == expected );
+    }
+}
+
+TEST_CASE( "Sanity check" ) {
     typedef IntervalTree<int, bool> ITree;
     ITree::interval_vector sanityIntervals;
     sanityIntervals.push_back(ITree::interval(60, 80, true));
@@ -127,13 +1395,17 @@ int main(int argc, char**argv) {
 
     ITree::interval_vector sanityResults;
     sanityResults = sanityTree.findOverlapping(30, 50);
-    assert(sanityResults.size() == 1);
+    REQUIRE( sanityResults.size() == 1 );
 
     sanityResults = sanityTree.findContained(15, 45);
-    assert(sanityResults.size() == 1);
+    REQUIRE( sanityResults.size() == 1 );
+}
 
+TEST_CASE( "Random queries agree with brute force" ) {
+    typedef vector<std::size_t> countsVector;
+    typedef IntervalTree<int, bool> ITree;
 
-    srand((unsigned)time(NULL));
+    srand(12345);
 
     ITree::interval_vector intervals;
     ITree::interval_vector queries;
@@ -147,43 +1419,30 @@ int main(int argc, char**argv) {
         queries.push_back(randomInterval<int, bool>(100000, 1000, 100000 + 1, true));
     }
 
-    typedef chrono::high_resolution_clock Clock;
-    typedef chrono::milliseconds milliseconds;
-
     // using brute-force search
     countsVector bruteforcecounts;
-    Clock::time_point t0 = Clock::now();
     for (auto q = queries.begin(); q != queries.end(); ++q) {
-        ITree::interval_vector results;
+        std::size_t count = 0;
         for (auto i = intervals.begin(); i != intervals.end(); ++i) {
             if (i->start >= q->start && i->stop <= q->stop) {
-                results.push_back(*i);
+                ++count;
             }
         }
-        bruteforcecounts.push_back(results.size());
+        bruteforcecounts.push_back(count);
     }
-    Clock::time_point t1 = Clock::now();
-    milliseconds ms = chrono::duration_cast<milliseconds>(t1 - t0);
-    cout << "brute force:\t" << ms.count() << "ms" << endl;
 
     // using the interval tree
-    cout << intervals[0];
     ITree tree = ITree(std::move(intervals), 16, 1);
     countsVector treecounts;
-    t0 = Clock::now();
     for (auto q = queries.begin(); q != queries.end(); ++q) {
         auto results = tree.findContained(q->start, q->stop);
         treecounts.push_back(results.size());
     }
-    t1 = Clock::now();
-    ms = std::chrono::duration_cast<milliseconds>(t1 - t0);
-    cout << "interval tree:\t" << ms.count() << "ms" << endl;
 
     // check that the same number of results are returned
-    countsVector::iterator b = bruteforcecounts.begin();
-    for (countsVector::iterator t = treecounts.begin(); t != treecounts.end(); ++t, ++b) {
-        assert(*b == *t);
-    }
+    REQUIRE( treecounts == bruteforcecounts );
+}
 
+int main(int argc, char**argv) {
     return Catch::Session().run( argc, argv );
 }
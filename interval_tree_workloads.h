@@ -0,0 +1,191 @@
+#ifndef __INTERVAL_TREE_WORKLOADS_H
+#define __INTERVAL_TREE_WORKLOADS_H
+
+#include <algorithm>
+#include <cmath>
+#include <cstddef>
+#include <random>
+#include <vector>
+
+#include "IntervalTree.h"
+
+// Interval sets for benchmarking. Every generator is deterministic for a
+// given seed, and the coordinate span grows with n so the coverage depth
+// stays roughly constant across sizes. The synthetic distributions come
+// first, followed by generators shaped like common genomic data.
+
+typedef IntervalTree<std::size_t, std::size_t> BenchTree;
+typedef BenchTree::interval BenchInterval;
+typedef BenchTree::interval_vector BenchIntervals;
+typedef std::mt19937_64 BenchRng;
+
+inline std::size_t workloadSpan(std::size_t n) {
+    return std::max<std::size_t>(n, 1) * 100;
+}
+
+// Uniform starts and lengths of up to 1000.
+inline void uniformWorkload(std::size_t n, BenchRng& rng, BenchIntervals& out) {
+    std::uniform_int_distribution<std::size_t> start(0, workloadSpan(n));
+    std::uniform_int_distribution<std::size_t> length(0, 1000);
+    for (std::size_t i = 0; i != n; ++i) {
+        const std::size_t s = start(rng);
+        out.push_back(BenchInterval(s, s + length(rng), i));
+    }
+}
+
+// Intervals gathered in tight clusters around a few hundred hot spots.
+inline void clusteredWorkload(std::size_t n, BenchRng& rng, BenchIntervals& out) {
+    const std::size_t span = workloadSpan(n);
+    std::uniform_int_distribution<std::size_t> hotspot(0, span);
+    std::vector<std::size_t> centers(std::max<std::size_t>(n / 1000, 16));
+    for (std::size_t& c : centers) {
+        c = hotspot(rng);
+    }
+    std::uniform_int_distribution<std::size_t> which(0, centers.size() - 1);
+    std::normal_distribution<double> offset(0, 2000);
+    std::uniform_int_distribution<std::size_t> length(0, 1000);
+    for (std::size_t i = 0; i != n; ++i) {
+        const double s = std::max(0.0, centers[which(rng)] + offset(rng));
+        const std::size_t start = static_cast<std::size_t>(s);
+        out.push_back(BenchInterval(start, start + length(rng), i));
+    }
+}
+
+// Uniform starts with Pareto-distributed lengths, so a small fraction of
+// intervals is very long.
+inline void heavyTailedWorkload(std::size_t n, BenchRng& rng, BenchIntervals& out) {
+    const std::size_t span = workloadSpan(n);
+    std::uniform_int_distribution<std::size_t> start(0, span);
+    std::uniform_real_distribution<double> u(0.0, 1.0);
+    const double alpha = 1.2;
+    const double minimum = 50;
+    for (std::size_t i = 0; i != n; ++i) {
+        const double l = std::min(minimum / std::pow(1.0 - u(rng), 1.0 / alpha), double(span));
+        const std::size_t s = start(rng);
+        out.push_back(BenchInterval(s, s + static_cast<std::size_t>(l), i));
+    }
+}
+
+// Groups of up to 16 intervals, each nested inside the previous one.
+inline void nestedWorkload(std::size_t n, BenchRng& rng, BenchIntervals& out) {
+    std::uniform_int_distribution<std::size_t> start(0, workloadSpan(n));
+    std::uniform_int_distribution<std::size_t> depth(1, 16);
+    std::uniform_int_distribution<std::size_t> shrink(0, 100);
+    while (out.size() < n) {
+        std::size_t s = start(rng);
+        std::size_t e = s + 4000;
+        for (std::size_t d = depth(rng); d != 0 && out.size() < n && s < e; --d) {
+            out.push_back(BenchInterval(s, e, out.size()));
+            s += shrink(rng);
+            e -= std::min(e - s, shrink(rng));
+        }
+    }
+}
+
+// Gene annotations: a gene, its transcripts, and the exons of each
+// transcript, all nested inside the gene.
+inline void geneWorkload(std::size_t n, BenchRng& rng, BenchIntervals& out) {
+    std::lognormal_distribution<double> geneLength(std::log(20000.0), 1.0);
+    std::uniform_int_distribution<std::size_t> intergenic(1000, 100000);
+    std::uniform_int_distribution<std::size_t> transcripts(1, 4);
+    std::uniform_int_distribution<std::size_t> exons(2, 12);
+    std::uniform_int_distribution<std::size_t> exonLength(50, 400);
+    std::size_t pos = 0;
+    while (out.size() < n) {
+        pos += intergenic(rng);
+        const std::size_t length = 1000 + static_cast<std::size_t>(geneLength(rng));
+        const std::size_t gene = pos;
+        out.push_back(BenchInterval(gene, gene + length, out.size()));
+        for (std::size_t t = transcripts(rng); t != 0 && out.size() < n; --t) {
+            std::uniform_int_distribution<std::size_t> trim(0, length / 10);
+            const std::size_t ts = gene + trim(rng);
+            const std::size_t te = gene + length - trim(rng);
+            out.push_back(BenchInterval(ts, te, out.size()));
+            const std::size_t count = exons(rng);
+            const std::size_t stride = (te - ts) / count;
+            for (std::size_t e = 0; e != count && out.size() < n; ++e) {
+                const std::size_t es = ts + e * stride;
+                out.push_back(BenchInterval(es, es + std::min(exonLength(rng), stride),
+                                            out.size()));
+            }
+        }
+        pos += length;
+    }
+}
+
+// 150bp read alignments with starts from a Poisson process at 30x coverage.
+inline void readWorkload(std::size_t n, BenchRng& rng, BenchIntervals& out) {
+    const double readLength = 150;
+    const double coverage = 30;
+    std::exponential_distribution<double> gap(coverage / readLength);
+    double pos = 0;
+    for (std::size_t i = 0; i != n; ++i) {
+        pos += gap(rng);
+        const std::size_t s = static_cast<std::size_t>(pos);
+        out.push_back(BenchInterval(s, s + static_cast<std::size_t>(readLength) - 1, i));
+    }
+}
+
+// Structural variant calls: mostly small events, with one in ten spanning
+// 100kb to 10Mb.
+inline void structuralVariantWorkload(std::size_t n, BenchRng& rng, BenchIntervals& out) {
+    std::uniform_int_distribution<std::size_t> start(0, workloadSpan(n));
+    std::uniform_int_distribution<std::size_t> small(50, 1000);
+    std::uniform_real_distribution<double> exponent(5.0, 7.0);
+    std::bernoulli_distribution isLong(0.1);
+    for (std::size_t i = 0; i != n; ++i) {
+        const std::size_t s = start(rng);
+        const std::size_t length = isLong(rng)
+            ? static_cast<std::size_t>(std::pow(10.0, exponent(rng)))
+            : small(rng);
+        out.push_back(BenchInterval(s, s + length, i));
+    }
+}
+
+// RepeatMasker-style annotation: back-to-back repeats tiling the sequence,
+// occasionally overlapping their neighbour or leaving a short gap.
+inline void repeatWorkload(std::size_t n, BenchRng& rng, BenchIntervals& out) {
+    std::lognormal_distribution<double> length(std::log(300.0), 0.8);
+    std::uniform_int_distribution<int> shift(-20, 50);
+    std::size_t pos = 0;
+    for (std::size_t i = 0; i != n; ++i) {
+        const std::size_t l = 10 + std::min<std::size_t>(static_cast<std::size_t>(length(rng)), 6000);
+        out.push_back(BenchInterval(pos, pos + l, i));
+        const int d = shift(rng);
+        pos = d < 0 ? pos + l - std::min<std::size_t>(l - 1, -d) : pos + l + d;
+    }
+}
+
+struct Workload {
+    const char* name;
+    void (*generate)(std::size_t n, BenchRng& rng, BenchIntervals& out);
+};
+
+static const Workload benchWorkloads[] = {
+    { "uniform", uniformWorkload },
+    { "clustered", clusteredWorkload },
+    { "heavy_tailed", heavyTailedWorkload },
+    { "nested", nestedWorkload },
+    { "genes", geneWorkload },
+    { "reads", readWorkload },
+    { "structural_variants", structuralVariantWorkload },
+    { "repeats", repeatWorkload },
+};
+
+// Query windows of up to 2000 positions spread uniformly over the extent
+// of the intervals.
+inline void queryWindows(std::size_t count, const BenchIntervals& intervals, BenchRng& rng,
+                         BenchIntervals& out) {
+    std::size_t last = 0;
+    for (const BenchInterval& i : intervals) {
+        last = std::max(last, i.stop);
+    }
+    std::uniform_int_distribution<std::size_t> start(0, last);
+    std::uniform_int_distribution<std::size_t> length(0, 2000);
+    for (std::size_t i = 0; i != count; ++i) {
+        const std::size_t s = start(rng);
+        out.push_back(BenchInterval(s, s + length(rng), i));
+    }
+}
+
+#endif